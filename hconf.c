@@ -42,6 +42,7 @@ __FBSDID("$FreeBSD$");
 #include <sys/sysctl.h>
 #include <sys/systm.h>
 #include <sys/sx.h>
+#include <sys/time.h>
 
 #include "hid.h"
 #include "hidbus.h"
@@ -105,6 +106,12 @@ struct hconf_softc {
 	struct sx		lock;
 
 	struct feature_control	feature_controls[CONTROLS_COUNT];
+
+	uint8_t			*fbuf;		/* Feature report buffer */
+	hid_size_t		fbuf_len;
+
+	u_int			restore_us;	/* Last resume restore time */
+	u_int			restore_max_us;
 };
 
 static device_probe_t		hconf_probe;
@@ -134,50 +141,61 @@ static const struct hid_device_id hconf_devs[] = {
 	{ HID_TLC(HUP_DIGITIZERS, HUD_CONFIG) },
 };
 
+/*
+ * Encode all controls sharing report of ctrl_id control into preallocated
+ * buffer and write it to device. Control ctrl_id gets value val.
+ */
 static int
-hconf_set_feature_control(struct hconf_softc *sc, int ctrl_id, u_int val)
+hconf_write_feature_report(struct hconf_softc *sc, int ctrl_id, u_int val)
 {
-	struct feature_control *fc;
-	uint8_t *fbuf;
-	int error;
+	struct feature_control *fc = &sc->feature_controls[ctrl_id];
 	int i;
 
-	KASSERT(ctrl_id >= 0 && ctrl_id < CONTROLS_COUNT,
-	    ("impossible ctrl id %d", ctrl_id));
-	fc = &sc->feature_controls[ctrl_id];
-	if (fc->rlen <= 1)
-		return (ENXIO);
-
-	fbuf = malloc(fc->rlen, M_TEMP, M_WAITOK | M_ZERO);
-	sx_xlock(&sc->lock);
+	sx_assert(&sc->lock, SA_XLOCKED);
+	KASSERT(fc->rlen <= sc->fbuf_len,
+	    ("report %d does not fit buffer: %d", fc->rid, fc->rlen));
 
 	/*
 	 * Assume the report is write-only. Then we have to check for other
 	 * controls that may share the same report and set their bits as well.
 	 */
-	bzero(fbuf + 1, fc->rlen - 1);
+	bzero(sc->fbuf + 1, fc->rlen - 1);
 	for (i = 0; i < nitems(sc->feature_controls); i++) {
 		struct feature_control *ofc = &sc->feature_controls[i];
 
 		/* Skip unrelated report IDs. */
-		if (ofc->rid != fc->rid)
+		if (ofc->rlen <= 1 || ofc->rid != fc->rid)
 			continue;
 		KASSERT(fc->rlen == ofc->rlen,
 		    ("different lengths for report %d: %d vs %d\n",
 		    fc->rid, fc->rlen, ofc->rlen));
-		hid_put_data_unsigned(fbuf + 1, ofc->rlen - 1, &ofc->loc,
+		hid_put_data_unsigned(sc->fbuf + 1, ofc->rlen - 1, &ofc->loc,
 		    i == ctrl_id ? val : ofc->val);
 	}
 
-	fbuf[0] = fc->rid;
+	sc->fbuf[0] = fc->rid;
+
+	return (hid_set_report(sc->dev, sc->fbuf, fc->rlen,
+	    HID_FEATURE_REPORT, fc->rid));
+}
 
-	error = hid_set_report(sc->dev, fbuf, fc->rlen,
-	    HID_FEATURE_REPORT, fc->rid);
+static int
+hconf_set_feature_control(struct hconf_softc *sc, int ctrl_id, u_int val)
+{
+	struct feature_control *fc;
+	int error;
+
+	KASSERT(ctrl_id >= 0 && ctrl_id < CONTROLS_COUNT,
+	    ("impossible ctrl id %d", ctrl_id));
+	fc = &sc->feature_controls[ctrl_id];
+	if (fc->rlen <= 1)
+		return (ENXIO);
+
+	sx_xlock(&sc->lock);
+	error = hconf_write_feature_report(sc, ctrl_id, val);
 	if (error == 0)
 		fc->val = val;
-
 	sx_unlock(&sc->lock);
-	free(fbuf, M_TEMP);
 
 	return (error);
 }
@@ -274,6 +292,17 @@ hconf_attach(device_t dev)
 			    feature_control_descrs[i].descr);
 		}
 		sc->feature_controls[i].val = feature_control_descrs[i].value;
+		sc->fbuf_len = MAX(sc->fbuf_len, sc->feature_controls[i].rlen);
+	}
+
+	if (sc->fbuf_len > 1) {
+		sc->fbuf = malloc(sc->fbuf_len, M_DEVBUF, M_WAITOK | M_ZERO);
+		SYSCTL_ADD_UINT(ctx, SYSCTL_CHILDREN(tree), OID_AUTO,
+		    "restore_latency", CTLFLAG_RD, &sc->restore_us, 0,
+		    "Last feature restore time on resume, us");
+		SYSCTL_ADD_UINT(ctx, SYSCTL_CHILDREN(tree), OID_AUTO,
+		    "restore_latency_max", CTLFLAG_RD, &sc->restore_max_us, 0,
+		    "Maximal feature restore time on resume, us");
 	}
 
 	return (0);
@@ -285,31 +314,60 @@ hconf_detach(device_t dev)
 	struct hconf_softc *sc = device_get_softc(dev);
 
 	sx_destroy(&sc->lock);
+	free(sc->fbuf, M_DEVBUF);
 
 	return (0);
 }
 
+static bool
+hconf_need_restore(struct hconf_softc *sc, int ctrl_id)
+{
+	struct feature_control *fc = &sc->feature_controls[ctrl_id];
+
+	/* Do not update usages to default value */
+	return (fc->rlen > 1 &&
+	    fc->val != feature_control_descrs[ctrl_id].value);
+}
+
 static int
 hconf_resume(device_t dev)
 {
 	struct hconf_softc *sc = device_get_softc(dev);
+	sbintime_t start;
+	u_int us;
 	int error;
-	int i;
+	int i, j;
+
+	if (sc->fbuf == NULL)
+		return (0);
 
+	start = sbinuptime();
+	sx_xlock(&sc->lock);
 	for (i = 0; i < nitems(sc->feature_controls); i++) {
-		if (sc->feature_controls[i].rlen < 2)
+		if (!hconf_need_restore(sc, i))
 			continue;
-		/* Do not update usages to default value */
-		if (sc->feature_controls[i].val ==
-		    feature_control_descrs[i].value)
+		/* Controls sharing report ID are restored with one write */
+		for (j = 0; j < i; j++)
+			if (hconf_need_restore(sc, j) &&
+			    sc->feature_controls[j].rid ==
+			    sc->feature_controls[i].rid)
+				break;
+		if (j < i)
 			continue;
-		error = hconf_set_feature_control(sc, i,
+		error = hconf_write_feature_report(sc, i,
 		    sc->feature_controls[i].val);
 		if (error != 0) {
-			DPRINTF("Failed to restore %s: %d\n",
+			DPRINTF("Failed to restore report %d (%s): %d\n",
+			    sc->feature_controls[i].rid,
 			    feature_control_descrs[i].name, error);
 		}
 	}
+	sx_unlock(&sc->lock);
+
+	us = sbttous(sbinuptime() - start);
+	sc->restore_us = us;
+	if (us > sc->restore_max_us)
+		sc->restore_max_us = us;
 
 	return (0);
 }
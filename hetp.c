@@ -112,11 +112,24 @@ SYSCTL_INT(_hw_hid_hetp, OID_AUTO, debug, CTLFLAG_RWTUN,
 #define	HETP_TOUCH_RMB		(1 << 1)
 #define	HETP_TOUCH_MMB		(1 << 2)
 
+#define	HETP_READ_BATCH_MAX	5
+
 #define	HETP_MAX_PRESSURE	255
 #define	HETP_FWIDTH_REDUCE	90
 #define	HETP_FINGER_MAX_WIDTH	15
 #define	HETP_PRESSURE_BASE	25
 
+/* Last reported state of MT slot */
+struct hetp_slot {
+	bool			active;
+	int32_t			x;
+	int32_t			y;
+	int32_t			p;
+	int32_t			ori;
+	int32_t			maj;
+	int32_t			min;
+};
+
 struct hetp_softc {
 	device_t		dev;
 
@@ -138,6 +151,8 @@ struct hetp_softc {
 	bool			hi_precission;
 	bool			is_clickpad;
 	bool			has_3buttons;
+
+	struct hetp_slot	slots[HETP_MAX_FINGERS];
 };
 
 static evdev_open_t	hetp_ev_open;
@@ -156,6 +171,8 @@ static device_resume_t	hetp_iic_resume;
 static device_suspend_t	hetp_iic_suspend;
 
 static int		hetp_iic_read_reg(device_t, uint16_t, size_t, void *);
+static int		hetp_iic_read_regs(device_t, const uint16_t *,
+			    uint16_t *, int);
 static int		hetp_iic_write_reg(device_t, uint16_t, uint16_t);
 static int		hetp_iic_set_absolute_mode(device_t, bool);
 static int		hetp_iic_set_power(device_t, bool);
@@ -270,6 +287,7 @@ hetp_attach(struct hetp_softc *sc)
 	void *d_ptr;
 	hid_size_t d_len;
 	int32_t minor, major;
+	sbintime_t start;
 	int error;
 
 	sc->report_id = sc->hi_precission ?
@@ -333,7 +351,9 @@ hetp_attach(struct hetp_softc *sc)
 	evdev_support_abs(sc->evdev, ABS_MT_TOUCH_MINOR, 0, 0, minor, 0, 0, 0);
 	evdev_support_abs(sc->evdev, ABS_DISTANCE, 0, 0, 1, 0, 0, 0);
 
+	start = sbinuptime();
 	error = evdev_register_mtx(sc->evdev, hidbus_get_lock(sc->dev));
+	hidbus_stat_evdev_register(sc->dev, start);
 	if (error != 0) {
 		hetp_detach(sc);
 		return (ENOMEM);
@@ -359,9 +379,11 @@ static void
 hetp_intr(void *context, void *buf, hid_size_t len)
 {
 	struct hetp_softc *sc = context;
+	struct hetp_slot *slot;
 	uint8_t *report, *fdata;
 	int32_t finger;
 	int32_t x, y, p, w, h, wh, ori, min, maj;
+	bool new;
 
 	/* we seem to get 0 length reports sometimes, ignore them */
 	report = buf;
@@ -399,17 +421,43 @@ hetp_intr(void *context, void *buf, hid_size_t len)
 			min = MIN(w, h);
 			p = MIN(p + sc->pressure_base, HETP_MAX_PRESSURE);
 
+			/* Report only slots and axes which have changed */
+			slot = &sc->slots[finger];
+			new = !slot->active;
+			if (!new && x == slot->x && y == slot->y &&
+			    p == slot->p && ori == slot->ori &&
+			    maj == slot->maj && min == slot->min)
+				continue;
+
 			evdev_push_abs(sc->evdev, ABS_MT_SLOT, finger);
-			evdev_push_abs(sc->evdev, ABS_MT_TRACKING_ID, finger);
-			evdev_push_abs(sc->evdev, ABS_MT_POSITION_X, x);
-			evdev_push_abs(sc->evdev, ABS_MT_POSITION_Y, y);
-			evdev_push_abs(sc->evdev, ABS_MT_PRESSURE, p);
-			evdev_push_abs(sc->evdev, ABS_MT_ORIENTATION, ori);
-			evdev_push_abs(sc->evdev, ABS_MT_TOUCH_MAJOR, maj);
-			evdev_push_abs(sc->evdev, ABS_MT_TOUCH_MINOR, min);
-		} else {
+			if (new)
+				evdev_push_abs(sc->evdev, ABS_MT_TRACKING_ID,
+				    finger);
+			if (new || x != slot->x)
+				evdev_push_abs(sc->evdev, ABS_MT_POSITION_X, x);
+			if (new || y != slot->y)
+				evdev_push_abs(sc->evdev, ABS_MT_POSITION_Y, y);
+			if (new || p != slot->p)
+				evdev_push_abs(sc->evdev, ABS_MT_PRESSURE, p);
+			if (new || ori != slot->ori)
+				evdev_push_abs(sc->evdev, ABS_MT_ORIENTATION,
+				    ori);
+			if (new || maj != slot->maj)
+				evdev_push_abs(sc->evdev, ABS_MT_TOUCH_MAJOR,
+				    maj);
+			if (new || min != slot->min)
+				evdev_push_abs(sc->evdev, ABS_MT_TOUCH_MINOR,
+				    min);
+			*slot = (struct hetp_slot) {
+				.active = true,
+				.x = x, .y = y, .p = p,
+				.ori = ori, .maj = maj, .min = min,
+			};
+		} else if (sc->slots[finger].active) {
+			/* Release slot once */
 			evdev_push_abs(sc->evdev, ABS_MT_SLOT, finger);
 			evdev_push_abs(sc->evdev, ABS_MT_TRACKING_ID, -1);
+			sc->slots[finger].active = false;
 		}
 	}
 
@@ -459,38 +507,34 @@ static int
 hetp_iic_attach(device_t dev)
 {
 	struct hetp_softc *sc = device_get_softc(dev);
-	uint16_t buf, reg;
+	static const uint16_t id_regs[] = {
+		HETP_UNIQUEID, HETP_PATTERN, HETP_IC_TYPE, HETP_NSM_VERSION,
+	};
+	static const uint16_t param_regs[] = {
+		HETP_MAX_X_AXIS, HETP_MAX_Y_AXIS, HETP_TRACENUM, HETP_PRESSURE,
+		HETP_RESOLUTION,
+	};
+	uint16_t id[nitems(id_regs)], param[nitems(param_regs)];
 	uint8_t *buf8;
 	uint8_t pattern;
 
-	buf8 = (uint8_t *)&buf;
-
 	hidbus_set_intr(dev, hetp_intr, sc);
 
-	if (hetp_iic_read_reg(dev, HETP_UNIQUEID, sizeof(buf), &buf) != 0) {
-		device_printf(sc->dev, "failed reading product ID\n");
+	if (hetp_iic_read_regs(dev, id_regs, id, nitems(id_regs)) != 0) {
+		device_printf(sc->dev, "failed reading device ID\n");
 		return (EIO);
 	}
-	sc->product_id = le16toh(buf);
+	sc->product_id = le16toh(id[0]);
 
-	if (hetp_iic_read_reg(dev, HETP_PATTERN, sizeof(buf), &buf) != 0) {
-		device_printf(sc->dev, "failed reading pattern\n");
-		return (EIO);
-	}
-	pattern = buf == 0xFFFF ? 0 : buf8[1];
+	buf8 = (uint8_t *)&id[1];
+	pattern = id[1] == 0xFFFF ? 0 : buf8[1];
 	sc->hi_precission = pattern >= 0x02;
 
-	reg = pattern >= 0x01 ? HETP_IC_TYPE : HETP_OSM_VERSION;
-	if (hetp_iic_read_reg(dev, reg, sizeof(buf), &buf) != 0) {
-		device_printf(sc->dev, "failed reading IC type\n");
-		return (EIO);
-	}
-	sc->ic_type = pattern >= 0x01 ? be16toh(buf) : buf8[1];
+	/* IC type and OSM version share the same register */
+	buf8 = (uint8_t *)&id[2];
+	sc->ic_type = pattern >= 0x01 ? be16toh(id[2]) : buf8[1];
 
-	if (hetp_iic_read_reg(dev, HETP_NSM_VERSION, sizeof(buf), &buf) != 0) {
-		device_printf(sc->dev, "failed reading SM version\n");
-		return (EIO);
-	}
+	buf8 = (uint8_t *)&id[3];
 	sc->is_clickpad = (buf8[0] & 0x10) != 0;
 
 	if (hetp_iic_set_absolute_mode(dev, true) != 0) {
@@ -498,35 +542,22 @@ hetp_iic_attach(device_t dev)
 		return (EIO);
 	}
 
-	if (hetp_iic_read_reg(dev, HETP_MAX_X_AXIS, sizeof(buf), &buf) != 0) {
-		device_printf(sc->dev, "failed reading max x\n");
+	if (hetp_iic_read_regs(dev, param_regs, param,
+	    nitems(param_regs)) != 0) {
+		device_printf(sc->dev, "failed reading device parameters\n");
 		return (EIO);
 	}
-	sc->max_x = le16toh(buf);
+	sc->max_x = le16toh(param[0]);
+	sc->max_y = le16toh(param[1]);
 
-	if (hetp_iic_read_reg(dev, HETP_MAX_Y_AXIS, sizeof(buf), &buf) != 0) {
-		device_printf(sc->dev, "failed reading max y\n");
-		return (EIO);
-	}
-	sc->max_y = le16toh(buf);
-
-	if (hetp_iic_read_reg(dev, HETP_TRACENUM, sizeof(buf), &buf) != 0) {
-		device_printf(sc->dev, "failed reading trace info\n");
-		return (EIO);
-	}
+	buf8 = (uint8_t *)&param[2];
 	sc->trace_x = sc->max_x / buf8[0];
 	sc->trace_y = sc->max_y / buf8[1];
 
-	if (hetp_iic_read_reg(dev, HETP_PRESSURE, sizeof(buf), &buf) != 0) {
-		device_printf(sc->dev, "failed reading pressure format");
-		return (EIO);
-	}
+	buf8 = (uint8_t *)&param[3];
 	sc->pressure_base = (buf8[0] & 0x10) ? 0 : HETP_PRESSURE_BASE;
 
-	if (hetp_iic_read_reg(dev, HETP_RESOLUTION, sizeof(buf), &buf)  != 0) {
-		device_printf(sc->dev, "failed reading resolution\n");
-		return (EIO);
-	}
+	buf8 = (uint8_t *)&param[4];
 	/* Conversion from internal format to dot per mm */
 	sc->res_x = hetp_res2dpmm(buf8[0], sc->hi_precission);
 	sc->res_y = hetp_res2dpmm(buf8[1], sc->hi_precission);
@@ -714,6 +745,59 @@ hetp_iic_read_reg(device_t dev, uint16_t reg, size_t len, void *val)
 	return (0);
 }
 
+/*
+ * Read a set of 16-bit registers with one combined I2C transfer while the
+ * bus is held, rather than doing separate transaction for each register.
+ * Fall back to register-by-register reads if controller rejects the chain.
+ */
+static int
+hetp_iic_read_regs(device_t dev, const uint16_t *regs, uint16_t *vals,
+    int nregs)
+{
+	device_t iichid = device_get_parent(device_get_parent(dev));
+	uint16_t addr = iicbus_get_addr(iichid) << 1;
+	uint8_t cmd[HETP_READ_BATCH_MAX][2];
+	struct iic_msg msgs[HETP_READ_BATCH_MAX * 2];
+	int i, error;
+
+	KASSERT(nregs <= HETP_READ_BATCH_MAX, ("Too many registers"));
+
+	for (i = 0; i < nregs; i++) {
+		cmd[i][0] = regs[i] & 0xff;
+		cmd[i][1] = (regs[i] >> 8) & 0xff;
+		msgs[i * 2] = (struct iic_msg) {
+		    addr, IIC_M_WR | IIC_M_NOSTOP, sizeof(cmd[i]), cmd[i]
+		};
+		msgs[i * 2 + 1] = (struct iic_msg) {
+		    addr, i == nregs - 1 ? IIC_M_RD : IIC_M_RD | IIC_M_NOSTOP,
+		    sizeof(vals[i]), (uint8_t *)&vals[i]
+		};
+	}
+
+	DPRINTF("Read %d regs starting from 0x%04x\n", nregs, regs[0]);
+
+	error = iic2errno(iicbus_transfer_excl(iichid, msgs, nregs * 2,
+	    IIC_WAIT));
+	if (error == 0) {
+		DPRINTF("Response: %*D\n", nregs * (int)sizeof(vals[0]),
+		    vals, " ");
+		return (0);
+	}
+
+	DPRINTF("Combined read failed: %d. Read one by one\n", error);
+	for (i = 0; i < nregs; i++) {
+		error = hetp_iic_read_reg(dev, regs[i], sizeof(vals[i]),
+		    &vals[i]);
+		if (error != 0) {
+			device_printf(dev, "failed reading reg 0x%04x\n",
+			    regs[i]);
+			return (error);
+		}
+	}
+
+	return (0);
+}
+
 static int
 hetp_iic_write_reg(device_t dev, uint16_t reg, uint16_t val)
 {
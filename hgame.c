@@ -36,7 +36,9 @@ __FBSDID("$FreeBSD$");
 #include <sys/param.h>
 #include <sys/bus.h>
 #include <sys/kernel.h>
+#include <sys/lock.h>
 #include <sys/module.h>
+#include <sys/mutex.h>
 #include <sys/sysctl.h>
 
 #include <dev/evdev/input.h>
@@ -179,6 +181,105 @@ hgame_final_cb(HIDMAP_CB_ARGS)
 	return (ENOSYS);
 }
 
+static const char *hgame_axis_names[] = {
+	[ABS_X] = "x", [ABS_Y] = "y", [ABS_Z] = "z",
+	[ABS_RX] = "rx", [ABS_RY] = "ry", [ABS_RZ] = "rz",
+	[ABS_THROTTLE] = "throttle", [ABS_RUDDER] = "rudder",
+	[ABS_WHEEL] = "wheel", [ABS_GAS] = "gas", [ABS_BRAKE] = "brake",
+};
+
+#define	HGAME_FILTER_FUZZ	0x10000	/* arg2 flag: hysteresis knob */
+
+static inline bool
+hgame_is_filtered_axis(const struct hidmap_hid_item *hi, uint16_t code)
+{
+
+	return ((hi->type == HIDMAP_TYPE_VARIABLE ||
+	    hi->type == HIDMAP_TYPE_VAR_NULLST) &&
+	    hi->evtype == EV_ABS && hi->code == code);
+}
+
+/*
+ * Several HID items can be mapped to the same axis code. Knob of the axis
+ * reads the first of them and sets all of them.
+ */
+static int
+hgame_filter_sysctl(SYSCTL_HANDLER_ARGS)
+{
+	struct hidmap *hm = arg1;
+	struct hidmap_hid_item *hi;
+	uint16_t code = arg2 & 0xffff;
+	bool fuzz = (arg2 & HGAME_FILTER_FUZZ) != 0;
+	uint16_t val = 0;
+	int error;
+
+	for (hi = hm->hid_items; hi < hm->hid_items + hm->nhid_items; hi++) {
+		if (hgame_is_filtered_axis(hi, code)) {
+			val = fuzz ? hi->fuzz : hi->flat;
+			break;
+		}
+	}
+
+	error = sysctl_handle_16(oidp, &val, 0, req);
+	if (error != 0 || req->newptr == NULL)
+		return (error);
+
+	mtx_lock(hidbus_get_lock(hm->dev));
+	for (hi = hm->hid_items; hi < hm->hid_items + hm->nhid_items; hi++) {
+		if (!hgame_is_filtered_axis(hi, code))
+			continue;
+		if (fuzz)
+			hi->fuzz = val;
+		else
+			hi->flat = val;
+	}
+	mtx_unlock(hidbus_get_lock(hm->dev));
+
+	return (0);
+}
+
+/*
+ * Export deadzone (flat) and hysteresis (fuzz) of each absolute axis as
+ * dev.<driver>.N.<axis>.{deadzone,hysteresis} for tuning at run time.
+ */
+void
+hgame_filter_sysctl_init(struct hidmap *hm)
+{
+	struct sysctl_ctx_list *ctx = device_get_sysctl_ctx(hm->dev);
+	struct sysctl_oid *tree = device_get_sysctl_tree(hm->dev);
+	struct sysctl_oid *node;
+	struct hidmap_hid_item *hi;
+	uint16_t code;
+
+	SYSCTL_ADD_U64(ctx, SYSCTL_CHILDREN(tree), OID_AUTO,
+	    "suppressed", CTLFLAG_RD, &hm->abs_suppressed, 0,
+	    "Number of axis events suppressed by deadzone and hysteresis");
+
+	/* One node per axis code, even if it is mapped more than once */
+	for (code = 0; code < nitems(hgame_axis_names); code++) {
+		if (hgame_axis_names[code] == NULL)
+			continue;
+		for (hi = hm->hid_items;
+		     hi < hm->hid_items + hm->nhid_items;
+		     hi++)
+			if (hgame_is_filtered_axis(hi, code))
+				break;
+		if (hi == hm->hid_items + hm->nhid_items)
+			continue;
+		node = SYSCTL_ADD_NODE(ctx, SYSCTL_CHILDREN(tree), OID_AUTO,
+		    hgame_axis_names[code], CTLFLAG_RW, NULL, "Axis filter");
+		SYSCTL_ADD_PROC(ctx, SYSCTL_CHILDREN(node), OID_AUTO,
+		    "deadzone", CTLTYPE_U16 | CTLFLAG_RW | CTLFLAG_MPSAFE,
+		    hm, code, hgame_filter_sysctl, "SU",
+		    "Values within this distance of the rest position are "
+		    "reported as rest position");
+		SYSCTL_ADD_PROC(ctx, SYSCTL_CHILDREN(node), OID_AUTO,
+		    "hysteresis", CTLTYPE_U16 | CTLFLAG_RW | CTLFLAG_MPSAFE,
+		    hm, code | HGAME_FILTER_FUZZ, hgame_filter_sysctl, "SU",
+		    "Changes smaller than this value are not reported");
+	}
+}
+
 static int
 hgame_probe(device_t dev)
 {
@@ -205,8 +306,14 @@ static int
 hgame_attach(device_t dev)
 {
 	struct hgame_softc *sc = device_get_softc(dev);
+	int error;
+
+	sc->hm.abs_filter = true;
+	error = hidmap_attach(&sc->hm);
+	if (error == 0)
+		hgame_filter_sysctl_init(&sc->hm);
 
-	return (hidmap_attach(&sc->hm));
+	return (error);
 }
 
 static int
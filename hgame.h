@@ -35,6 +35,8 @@ hidmap_cb_t	hgame_hat_switch_cb;
 hidmap_cb_t	hgame_dpad_cb;
 hidmap_cb_t	hgame_final_cb;
 
+void		hgame_filter_sysctl_init(struct hidmap *);
+
 struct hgame_softc {
 	struct hidmap	hm;
 	bool		dpad_up;
@@ -38,16 +38,30 @@
 #include <sys/kernel.h>
 #include <sys/lock.h>
 #include <sys/module.h>
+#include <sys/mutex.h>
 #include <sys/proc.h>
+#include <sys/queue.h>
+#include <sys/systm.h>
 
 #include "hid.h"
 #include "hidquirk.h"
 
 #include "hid_if.h"
 
+CTASSERT(HID_QUIRK_MAX <= HID_QUIRK_BITS);
+
 static hid_test_quirk_t hid_test_quirk_w;
 hid_test_quirk_t *hid_test_quirk_p = &hid_test_quirk_w;
 
+/* Devices with resolved quirk bitmaps. Refreshed on quirk table changes */
+static LIST_HEAD(, hid_device_info) hid_quirk_devs =
+    LIST_HEAD_INITIALIZER(hid_quirk_devs);
+static struct mtx hid_quirk_mtx;
+MTX_SYSINIT(hid_quirk_mtx, &hid_quirk_mtx, "HID quirk devices", MTX_DEF);
+
+#define	HID_QUIRK_WORD(q)	((q) / 32)
+#define	HID_QUIRK_MASK(q)	(1u << ((q) % 32))
+
 int
 hid_report_size_1(const void *buf, hid_size_t len, enum hid_kind k, uint8_t id)
 {
@@ -97,22 +111,24 @@ hid_report_size_1(const void *buf, hid_size_t len, enum hid_kind k, uint8_t id)
 bool
 hid_test_quirk(const struct hid_device_info *dev_info, uint16_t quirk)
 {
-	bool found;
-	uint8_t x;
 
-	if (quirk == HQ_NONE)
+	if (quirk == HQ_NONE || quirk >= HID_QUIRK_BITS)
 		return (false);
 
-	/* search the automatic per device quirks first */
-	for (x = 0; x != HID_MAX_AUTO_QUIRK; x++) {
-		if (dev_info->autoQuirk[x] == quirk)
-			return (true);
-	}
+	if (dev_info->quirks_resolved)
+		return ((atomic_load_acq_int(
+		    &dev_info->quirks[HID_QUIRK_WORD(quirk)]) &
+		    HID_QUIRK_MASK(quirk)) != 0);
 
-	/* search global quirk table, if any */
-	found = (hid_test_quirk_p) (dev_info, quirk);
+	/*
+	 * Quirks are not resolved yet. It is a case of transport probe.
+	 * Search the automatic per device quirks first.
+	 */
+	if (isset(dev_info->autoQuirk, quirk))
+		return (true);
 
-	return (found);
+	/* search global quirk table, if any */
+	return ((hid_test_quirk_p) (dev_info, quirk));
 }
 
 static bool
@@ -124,16 +140,84 @@ hid_test_quirk_w(const struct hid_device_info *dev_info, uint16_t quirk)
 int
 hid_add_dynamic_quirk(struct hid_device_info *dev_info, uint16_t quirk)
 {
-	uint8_t x;
 
-	for (x = 0; x != HID_MAX_AUTO_QUIRK; x++) {
-		if (dev_info->autoQuirk[x] == 0 ||
-		    dev_info->autoQuirk[x] == quirk) {
-			dev_info->autoQuirk[x] = quirk;
-			return (0);     /* success */
-		}
+	if (quirk == HQ_NONE)
+		return (0);
+	if (quirk >= HID_QUIRK_BITS)
+		return (EINVAL);
+
+	/* Serialize with hid_quirk_resolve() to not lose the bit */
+	mtx_lock(&hid_quirk_mtx);
+	setbit(dev_info->autoQuirk, quirk);
+	if (dev_info->quirks_resolved)
+		atomic_set_int(&dev_info->quirks[HID_QUIRK_WORD(quirk)],
+		    HID_QUIRK_MASK(quirk));
+	mtx_unlock(&hid_quirk_mtx);
+
+	return (0);
+}
+
+/*
+ * Build resolved bitmap aside and publish it word by word. A quirk test
+ * reads a single word, so it sees either old or new state of each bit.
+ */
+static void
+hid_quirk_resolve(struct hid_device_info *dev_info)
+{
+	u_int quirks[HID_QUIRK_WORDS] = { 0 };
+	uint16_t quirk;
+	int i;
+
+	mtx_assert(&hid_quirk_mtx, MA_OWNED);
+
+	for (quirk = HQ_NONE + 1; quirk < HID_QUIRK_BITS; quirk++)
+		if (isset(dev_info->autoQuirk, quirk) ||
+		    (quirk < HID_QUIRK_MAX &&
+		    (hid_test_quirk_p) (dev_info, quirk)))
+			quirks[HID_QUIRK_WORD(quirk)] |= HID_QUIRK_MASK(quirk);
+	for (i = 0; i < HID_QUIRK_WORDS; i++)
+		atomic_store_rel_int(&dev_info->quirks[i], quirks[i]);
+}
+
+/*------------------------------------------------------------------------*
+ *	hid_quirk_attach - resolve device quirks to bitmap
+ *
+ * After this call hid_test_quirk() is a single bit test. The bitmap is
+ * kept up to date with the global quirk table until hid_quirk_detach().
+ *------------------------------------------------------------------------*/
+void
+hid_quirk_attach(struct hid_device_info *dev_info)
+{
+
+	mtx_lock(&hid_quirk_mtx);
+	hid_quirk_resolve(dev_info);
+	dev_info->quirks_resolved = true;
+	LIST_INSERT_HEAD(&hid_quirk_devs, dev_info, quirks_link);
+	mtx_unlock(&hid_quirk_mtx);
+}
+
+void
+hid_quirk_detach(struct hid_device_info *dev_info)
+{
+
+	mtx_lock(&hid_quirk_mtx);
+	if (dev_info->quirks_resolved) {
+		LIST_REMOVE(dev_info, quirks_link);
+		dev_info->quirks_resolved = false;
 	}
-	return (ENOSPC);
+	mtx_unlock(&hid_quirk_mtx);
+}
+
+/* Re-resolve quirks of all attached devices after quirk table change */
+void
+hid_quirk_update(void)
+{
+	struct hid_device_info *dev_info;
+
+	mtx_lock(&hid_quirk_mtx);
+	LIST_FOREACH(dev_info, &hid_quirk_devs, quirks_link)
+		hid_quirk_resolve(dev_info);
+	mtx_unlock(&hid_quirk_mtx);
 }
 
 void
@@ -141,9 +225,7 @@ hidquirk_unload(void *arg)
 {
 	/* reset function pointer */
 	hid_test_quirk_p = &hid_test_quirk_w;
-#ifdef NOT_YET
-	hidquirk_ioctl_p = &hidquirk_ioctl_w;
-#endif
+	hid_quirk_update();
 
 	/* wait for CPU to exit the loaded functions, if any */
 
@@ -203,5 +285,58 @@ hid_set_protocol(device_t dev, uint16_t protocol)
 	return (HID_SET_PROTOCOL(device_get_parent(dev), protocol));
 }
 
+#ifdef INVARIANTS
+/*
+ * Check hid_get_udata_cls() and hid_get_data_cls() shortcuts against
+ * generic hid_get_udata() and hid_get_data() extractors at module load.
+ * Every position within first 4 bytes is tried with every shortcut size
+ * and with report lengths from empty to full, so truncated fields are
+ * covered as well.
+ */
+static const uint8_t hid_loc_test_data[][8] = {
+	{ 0x5a, 0xa5, 0x81, 0x7e, 0xff, 0x00, 0x80, 0x01 },
+	{ 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff },
+	{ 0x80, 0x00, 0x00, 0x80, 0x00, 0x00, 0x00, 0x80 },
+};
+static const uint32_t hid_loc_test_sizes[] = { 1, 8, 16, 32 };
+
+static void
+hid_loc_selftest_loc(const uint8_t *buf, struct hid_location *loc)
+{
+	hid_size_t len;
+	uint8_t cls;
+
+	cls = hid_loc_class(loc);
+	for (len = 0; len <= sizeof(hid_loc_test_data[0]); len++) {
+		KASSERT(hid_get_udata_cls(buf, len, loc, cls) ==
+		    hid_get_udata(buf, len, loc),
+		    ("hid_get_udata_cls: pos %u size %u len %u mismatch",
+		    loc->pos, loc->size, len));
+		KASSERT(hid_get_data_cls(buf, len, loc, cls) ==
+		    hid_get_data(buf, len, loc),
+		    ("hid_get_data_cls: pos %u size %u len %u mismatch",
+		    loc->pos, loc->size, len));
+	}
+}
+
+static void
+hid_loc_selftest(void *arg __unused)
+{
+	struct hid_location loc = { .count = 1 };
+	u_int i, j;
+
+	for (i = 0; i < nitems(hid_loc_test_data); i++) {
+		for (j = 0; j < nitems(hid_loc_test_sizes); j++) {
+			loc.size = hid_loc_test_sizes[j];
+			for (loc.pos = 0; loc.pos < 32; loc.pos++)
+				hid_loc_selftest_loc(hid_loc_test_data[i],
+				    &loc);
+		}
+	}
+}
+SYSINIT(hid_loc_selftest, SI_SUB_DRIVERS, SI_ORDER_ANY, hid_loc_selftest,
+    NULL);
+#endif
+
 MODULE_DEPEND(hid, usb, 1, 1, 1);
 MODULE_VERSION(hid, 1);
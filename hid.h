@@ -31,6 +31,9 @@
 #ifndef _HID_H_
 #define	_HID_H_
 
+#include <sys/endian.h>
+#include <sys/queue.h>
+
 #include <dev/usb/usb.h>
 #include <dev/usb/usbdi.h>
 #include <dev/usb/usbhid.h>
@@ -72,7 +75,8 @@ SYSCTL_DECL(_hw_hid);
 #define	HID_OUTPUT_REPORT	0x2
 #define	HID_FEATURE_REPORT	0x3
 
-#define	HID_MAX_AUTO_QUIRK	8	/* maximum number of dynamic quirks */
+#define	HID_QUIRK_BITS		64	/* bitmap size, >= HID_QUIRK_MAX */
+#define	HID_QUIRK_WORDS		howmany(HID_QUIRK_BITS, 32)
 #define	HID_PNP_ID_SIZE		20	/* includes null terminator */
 
 #define	HID_IN_POLLING_MODE_FUNC() hid_in_polling_mode()
@@ -95,7 +99,14 @@ struct hid_device_info {
 	uint16_t	idProduct;
 	uint16_t	idVersion;
 	hid_size_t	rdescsize;	/* Report descriptor size */
-	uint8_t		autoQuirk[HID_MAX_AUTO_QUIRK];
+	uint8_t		autoQuirk[HID_QUIRK_BITS / NBBY];	/* Dynamic */
+	/*
+	 * Resolved quirks. hid_test_quirk() reads them without locking, so
+	 * every word is only updated with a single atomic operation.
+	 */
+	volatile u_int	quirks[HID_QUIRK_WORDS];
+	bool		quirks_resolved;
+	LIST_ENTRY(hid_device_info) quirks_link;
 };
 
 struct hid_rdesc_info {
@@ -128,6 +139,79 @@ hid_get_udata(const uint8_t *buf, hid_size_t len, struct hid_location *loc)
 	return (hid_get_data_unsigned(buf, len, loc));
 }
 
+/*
+ * Extractor classes of HID item locations. Single bits and byte-aligned
+ * little-endian fields of 8, 16 and 32 bits are fetched with direct loads
+ * rather than with bit-walking hid_get_data(). Location class should be
+ * obtained once with hid_loc_class() and stored along with location.
+ */
+#define	HID_LOC_GENERIC	0
+#define	HID_LOC_BIT	1
+#define	HID_LOC_U8	2
+#define	HID_LOC_U16	3
+#define	HID_LOC_U32	4
+
+static __inline uint8_t
+hid_loc_class(const struct hid_location *loc)
+{
+	if (loc->size == 1)
+		return (HID_LOC_BIT);
+	if (loc->pos % 8 != 0)
+		return (HID_LOC_GENERIC);
+	switch (loc->size) {
+	case 8:
+		return (HID_LOC_U8);
+	case 16:
+		return (HID_LOC_U16);
+	case 32:
+		return (HID_LOC_U32);
+	}
+	return (HID_LOC_GENERIC);
+}
+
+/* Same as hid_get_udata() but takes shortcut for known location class */
+static __inline uint32_t
+hid_get_udata_cls(const uint8_t *buf, hid_size_t len,
+    struct hid_location *loc, uint8_t cls)
+{
+	hid_size_t off = loc->pos / 8;
+
+	switch (cls) {
+	case HID_LOC_BIT:
+		return (off < len ? (buf[off] >> (loc->pos % 8)) & 1 : 0);
+	case HID_LOC_U8:
+		return (off < len ? buf[off] : 0);
+	case HID_LOC_U16:
+		if (off + 2 <= len)
+			return (le16dec(buf + off));
+		break;
+	case HID_LOC_U32:
+		if (off + 4 <= len)
+			return (le32dec(buf + off));
+		break;
+	}
+	/* Generic location or field truncated by report length */
+	return (hid_get_udata(buf, len, loc));
+}
+
+/* Same as hid_get_data() but takes shortcut for known location class */
+static __inline int32_t
+hid_get_data_cls(const uint8_t *buf, hid_size_t len,
+    struct hid_location *loc, uint8_t cls)
+{
+	switch (cls) {
+	case HID_LOC_BIT:
+		return (-(int32_t)hid_get_udata_cls(buf, len, loc, cls));
+	case HID_LOC_U8:
+		return ((int8_t)hid_get_udata_cls(buf, len, loc, cls));
+	case HID_LOC_U16:
+		return ((int16_t)hid_get_udata_cls(buf, len, loc, cls));
+	case HID_LOC_U32:
+		return ((int32_t)hid_get_udata_cls(buf, len, loc, cls));
+	}
+	return (hid_get_data(buf, len, loc));
+}
+
 extern hid_test_quirk_t *hid_test_quirk_p;
 
 /*
@@ -139,6 +223,9 @@ int	hid_report_size_1(const void *buf, hid_size_t len, enum hid_kind k,
 bool	hid_test_quirk(const struct hid_device_info *dev_info, uint16_t quirk);
 int	hid_add_dynamic_quirk(struct hid_device_info *dev_info,
 	    uint16_t quirk);
+void	hid_quirk_attach(struct hid_device_info *dev_info);
+void	hid_quirk_detach(struct hid_device_info *dev_info);
+void	hid_quirk_update(void);
 void	hidquirk_unload(void *arg);
 int	hid_in_polling_mode(void);
 
@@ -38,11 +38,11 @@ extern int hid_debug;
 /* Check if HID debugging is enabled. */
 #ifdef HID_DEBUG_VAR
 #ifdef HID_DEBUG
-#define	DPRINTFN(n,fmt,...) do {		\
-  if ((HID_DEBUG_VAR) >= (n)) {			\
-    printf("%s: " fmt,				\
-	   __FUNCTION__ ,##__VA_ARGS__);	\
-  }						\
+#define	DPRINTFN(n,fmt,...) do {			\
+  if (__predict_false((HID_DEBUG_VAR) >= (n))) {	\
+    printf("%s: " fmt,					\
+	   __FUNCTION__ ,##__VA_ARGS__);		\
+  }							\
 } while (0)
 #define	DPRINTF(...)	DPRINTFN(1, __VA_ARGS__)
 #else
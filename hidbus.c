@@ -30,12 +30,17 @@ __FBSDID("$FreeBSD$");
 
 #include <sys/param.h>
 #include <sys/bus.h>
+#include <sys/counter.h>
 #include <sys/kernel.h>
 #include <sys/lock.h>
+#include <sys/malloc.h>
 #include <sys/module.h>
 #include <sys/mutex.h>
 #include <sys/queue.h>
+#include <sys/sbuf.h>
+#include <sys/sysctl.h>
 #include <sys/systm.h>
+#include <sys/time.h>
 
 #include "hid.h"
 #include "hidbus.h"
@@ -52,6 +57,51 @@ __FBSDID("$FreeBSD$");
 #endif
 
 #define	HID_RSIZE_MAX	1024
+#define	HID_NREPORT_IDS	256
+
+/* Input report length validation modes */
+#define	HIDBUS_RCHECK_OFF	0	/* Do not check */
+#define	HIDBUS_RCHECK_COUNT	1	/* Count malformed reports */
+#define	HIDBUS_RCHECK_DROP	2	/* Count and drop malformed reports */
+
+/* Input report observer time budget, us */
+#define	HIDBUS_TAP_BUDGET_DEF	50
+/* Observer is muted after this many budget overruns within a window */
+#define	HIDBUS_TAP_MAX_OVERRUNS	8
+#define	HIDBUS_TAP_WINDOW	64	/* Calls */
+
+/* Timed bus attach, detach and reconfiguration phases */
+enum hidbus_phase {
+	HIDBUS_PHASE_RDESC,	/* Report descriptor fetch */
+	HIDBUS_PHASE_RDESC_INFO, /* hidbus_fill_rdesc_info() */
+	HIDBUS_PHASE_ENUMERATE,	/* Top level collection enumeration */
+	HIDBUS_PHASE_PROBE,	/* Identify and probe of children */
+	HIDBUS_PHASE_ATTACH,	/* Attach of all children */
+	HIDBUS_PHASE_DETACH,	/* Detach and deletion of all children */
+	HIDBUS_PHASE_REENUMERATE, /* hid_set_report_descr() */
+	HIDBUS_PHASE_CNT,
+};
+
+static const char *hidbus_phase_names[HIDBUS_PHASE_CNT] = {
+	[HIDBUS_PHASE_RDESC] = "rdesc",
+	[HIDBUS_PHASE_RDESC_INFO] = "rdesc_info",
+	[HIDBUS_PHASE_ENUMERATE] = "enumerate",
+	[HIDBUS_PHASE_PROBE] = "probe",
+	[HIDBUS_PHASE_ATTACH] = "attach",
+	[HIDBUS_PHASE_DETACH] = "detach",
+	[HIDBUS_PHASE_REENUMERATE] = "reenumerate",
+};
+
+#define	HIDBUS_SINCE_US(start)	((u_int)sbttous(sbinuptime() - (start)))
+
+/* Identical copies of a report after which SET_IDLE is deemed ignored */
+#define	HIDBUS_DEDUP_PROOF	8
+
+static int hidbus_dedup = 0;
+static SYSCTL_NODE(_hw_hid, OID_AUTO, hidbus, CTLFLAG_RW, 0, "hidbus");
+SYSCTL_INT(_hw_hid_hidbus, OID_AUTO, dedup, CTLFLAG_RWTUN,
+    &hidbus_dedup, 0,
+    "Drop repeated input reports of devices which ignore SET_IDLE");
 
 static hid_intr_t	hidbus_intr;
 
@@ -69,6 +119,40 @@ struct hidbus_ivars {
 	void				*intr_ctx;
 	bool				open;
 	STAILQ_ENTRY(hidbus_ivars)	link;
+
+	/* Rate meters. Rates are recalculated on read, at most once a sec */
+	counter_u64_t			stats[HIDBUS_STAT_CNT];
+	uint64_t			rate_last[HIDBUS_STAT_CNT];
+	sbintime_t			rate_stamp[HIDBUS_STAT_CNT];
+	u_int				rate[HIDBUS_STAT_CNT];
+	struct sysctl_ctx_list		sysctl_ctx;
+	struct sysctl_oid		*stats_oid; /* Named after driver */
+
+	u_int				attach_us; /* Probe and attach time */
+	u_int				evdev_us; /* evdev registration time */
+};
+
+struct hidbus_tap {
+	hidbus_tap_t			*handler;
+	void				*context;
+	const char			*name;
+	sbintime_t			budget;
+	STAILQ_ENTRY(hidbus_tap)	link;
+
+	uint64_t			calls;
+	uint64_t			overruns;
+	u_int				win_calls;
+	u_int				win_overruns;
+	bool				muted;
+};
+
+/* Last seen input report with given report ID */
+struct hidbus_last_report {
+	hid_size_t			maxlen;
+	hid_size_t			len;	/* 0 if nothing seen yet */
+	u_int				repeats; /* Identical copies in a row */
+	bool				dedup;	/* SET_IDLE is ignored */
+	uint8_t				data[];
 };
 
 struct hidbus_softc {
@@ -84,6 +168,29 @@ struct hidbus_softc {
 	int				nauto;	/* Number of autochildren */
 
 	STAILQ_HEAD(, hidbus_ivars)	tlcs;
+	STAILQ_HEAD(, hidbus_tap)	taps;
+
+	u_int				phase_us[HIDBUS_PHASE_CNT];
+	sbintime_t			attach_start;
+
+	struct sysctl_oid		*stats_tree;
+
+	/*
+	 * Input report length validation. Expected sizes include report
+	 * ID byte and are indexed by report ID. 0 means unknown ID.
+	 */
+	int				rcheck;
+	bool				rcheck_ready;
+	bool				rcheck_has_id;
+	hid_size_t			*rsizes;
+	uint64_t			*rrejects;
+
+	/*
+	 * Repeated input report suppression. Indexed by report ID, NULL for
+	 * IDs carrying relative data which are never suppressed.
+	 */
+	struct hidbus_last_report	**last_report;
+	uint64_t			dups;
 };
 
 static int
@@ -167,6 +274,114 @@ hidbus_locate(const void *desc, hid_size_t size, int32_t u, enum hid_kind k,
 	return (0);
 }
 
+static int
+hidbus_stats_rate_sysctl(SYSCTL_HANDLER_ARGS)
+{
+	struct hidbus_ivars *tlc = arg1;
+	struct hidbus_softc *sc = device_get_softc(
+	    device_get_parent(tlc->child));
+	sbintime_t now, elapsed;
+	uint64_t val;
+	u_int rate;
+	int stat = arg2;
+
+	now = sbinuptime();
+	val = counter_u64_fetch(tlc->stats[stat]);
+
+	mtx_lock(sc->lock);
+	elapsed = now - tlc->rate_stamp[stat];
+	if (tlc->rate_stamp[stat] != 0 && elapsed >= SBT_1S) {
+		tlc->rate[stat] = (val - tlc->rate_last[stat]) * 1000 /
+		    sbttoms(elapsed);
+	}
+	if (tlc->rate_stamp[stat] == 0 || elapsed >= SBT_1S) {
+		tlc->rate_last[stat] = val;
+		tlc->rate_stamp[stat] = now;
+	}
+	rate = tlc->rate[stat];
+	mtx_unlock(sc->lock);
+
+	return (sysctl_handle_int(oidp, &rate, 0, req));
+}
+
+static void
+hidbus_stats_init(struct hidbus_ivars *tlc)
+{
+	int i;
+
+	for (i = 0; i < HIDBUS_STAT_CNT; i++)
+		tlc->stats[i] = counter_u64_alloc(M_WAITOK);
+	sysctl_ctx_init(&tlc->sysctl_ctx);
+}
+
+/*
+ * Export child statistics as dev.hidbus.N.stats.<child nameunit>. The node
+ * is created when the child driver installs its interrupt handler during
+ * attach and removed when the driver detaches, so its name always matches
+ * the driver instance which the counters belong to.
+ */
+static void
+hidbus_stats_sysctl_init(device_t bus, struct hidbus_ivars *tlc)
+{
+	struct hidbus_softc *sc = device_get_softc(bus);
+	struct sysctl_oid_list *list;
+
+	if (sc->stats_tree == NULL || tlc->stats_oid != NULL)
+		return;
+
+	tlc->stats_oid = SYSCTL_ADD_NODE(&tlc->sysctl_ctx,
+	    SYSCTL_CHILDREN(sc->stats_tree), OID_AUTO,
+	    device_get_nameunit(tlc->child), CTLFLAG_RD, NULL,
+	    "Child device statistics");
+	list = SYSCTL_CHILDREN(tlc->stats_oid);
+
+	SYSCTL_ADD_COUNTER_U64(&tlc->sysctl_ctx, list, OID_AUTO, "reports",
+	    CTLFLAG_RD, &tlc->stats[HIDBUS_STAT_REPORTS],
+	    "Input reports delivered");
+	SYSCTL_ADD_COUNTER_U64(&tlc->sysctl_ctx, list, OID_AUTO, "bytes",
+	    CTLFLAG_RD, &tlc->stats[HIDBUS_STAT_BYTES],
+	    "Input report bytes delivered");
+	SYSCTL_ADD_COUNTER_U64(&tlc->sysctl_ctx, list, OID_AUTO, "events",
+	    CTLFLAG_RD, &tlc->stats[HIDBUS_STAT_EVENTS],
+	    "evdev event frames emitted");
+	SYSCTL_ADD_COUNTER_U64(&tlc->sysctl_ctx, list, OID_AUTO, "drops",
+	    CTLFLAG_RD, &tlc->stats[HIDBUS_STAT_DROPS],
+	    "Input reports dropped by child");
+	SYSCTL_ADD_PROC(&tlc->sysctl_ctx, list, OID_AUTO, "reports_rate",
+	    CTLTYPE_UINT | CTLFLAG_RD, tlc, HIDBUS_STAT_REPORTS,
+	    hidbus_stats_rate_sysctl, "IU", "Input reports per second");
+	SYSCTL_ADD_PROC(&tlc->sysctl_ctx, list, OID_AUTO, "events_rate",
+	    CTLTYPE_UINT | CTLFLAG_RD, tlc, HIDBUS_STAT_EVENTS,
+	    hidbus_stats_rate_sysctl, "IU", "evdev event frames per second");
+	SYSCTL_ADD_UINT(&tlc->sysctl_ctx, list, OID_AUTO, "attach_time",
+	    CTLFLAG_RD, &tlc->attach_us, 0,
+	    "Last driver probe and attach time, us");
+	SYSCTL_ADD_UINT(&tlc->sysctl_ctx, list, OID_AUTO, "evdev_register_time",
+	    CTLFLAG_RD, &tlc->evdev_us, 0,
+	    "Last evdev device registration time, us");
+}
+
+static void
+hidbus_stats_sysctl_fini(struct hidbus_ivars *tlc)
+{
+
+	if (tlc->stats_oid == NULL)
+		return;
+	sysctl_ctx_free(&tlc->sysctl_ctx);
+	sysctl_ctx_init(&tlc->sysctl_ctx);
+	tlc->stats_oid = NULL;
+}
+
+static void
+hidbus_stats_fini(struct hidbus_ivars *tlc)
+{
+	int i;
+
+	sysctl_ctx_free(&tlc->sysctl_ctx);
+	for (i = 0; i < HIDBUS_STAT_CNT; i++)
+		counter_u64_free(tlc->stats[i]);
+}
+
 static device_t
 hidbus_add_child(device_t dev, u_int order, const char *name, int unit)
 {
@@ -180,6 +395,7 @@ hidbus_add_child(device_t dev, u_int order, const char *name, int unit)
 
 	tlc = malloc(sizeof(struct hidbus_ivars), M_DEVBUF, M_WAITOK | M_ZERO);
 	tlc->child = child;
+	hidbus_stats_init(tlc);
 	device_set_ivars(child, tlc);
 	mtx_lock(sc->lock);
 	STAILQ_INSERT_TAIL(&sc->tlcs, tlc, link);
@@ -227,43 +443,322 @@ hidbus_enumerate_children(device_t dev, const void* data, hid_size_t len)
 	return (0);
 }
 
+static void
+hidbus_free_last_reports(struct hidbus_softc *sc)
+{
+	int id;
+
+	for (id = 0; id < HID_NREPORT_IDS; id++) {
+		free(sc->last_report[id], M_DEVBUF);
+		sc->last_report[id] = NULL;
+	}
+}
+
+static void
+hidbus_reset_last_reports(struct hidbus_softc *sc)
+{
+	int id;
+
+	if (sc->last_report == NULL)
+		return;
+	for (id = 0; id < HID_NREPORT_IDS; id++)
+		if (sc->last_report[id] != NULL)
+			sc->last_report[id]->len = 0;
+}
+
+/*
+ * Collect expected input report sizes for all report IDs declared in
+ * report descriptor. Called with interrupts stopped.
+ */
+static void
+hidbus_setup_rcheck(struct hidbus_softc *sc)
+{
+	struct hid_device_info *devinfo = device_get_ivars(sc->dev);
+	struct hidbus_last_report *lr;
+	struct hid_data *hd;
+	struct hid_item hi;
+	uint8_t rel[howmany(HID_NREPORT_IDS, NBBY)] = { 0 };
+	int id;
+
+	memset(sc->rsizes, 0, HID_NREPORT_IDS * sizeof(sc->rsizes[0]));
+	memset(sc->rrejects, 0, HID_NREPORT_IDS * sizeof(sc->rrejects[0]));
+	hidbus_free_last_reports(sc);
+	sc->rcheck_has_id = false;
+	sc->rcheck_ready = false;
+	if (sc->rdesc.data == NULL || sc->rdesc.len == 0)
+		return;
+
+	/* Mark declared IDs first, then measure each one */
+	hd = hid_start_parse(sc->rdesc.data, sc->rdesc.len, 1 << hid_input);
+	while (hid_get_item(hd, &hi)) {
+		if (hi.kind != hid_input)
+			continue;
+		sc->rsizes[hi.report_ID] = 1;
+		if (hi.report_ID != 0)
+			sc->rcheck_has_id = true;
+		if ((hi.flags & (HIO_CONST | HIO_RELATIVE)) == HIO_RELATIVE)
+			setbit(rel, hi.report_ID);
+	}
+	hid_end_parse(hd);
+
+	for (id = 0; id < HID_NREPORT_IDS; id++) {
+		if (sc->rsizes[id] == 0)
+			continue;
+		sc->rsizes[id] = hid_report_size_1(sc->rdesc.data,
+		    sc->rdesc.len, hid_input, id);
+		if (isset(rel, id) || sc->rsizes[id] == 0)
+			continue;
+		lr = malloc(sizeof(*lr) + sc->rsizes[id], M_DEVBUF,
+		    M_ZERO | M_WAITOK);
+		lr->maxlen = sc->rsizes[id];
+		lr->dedup = hid_test_quirk(devinfo, HQ_NO_SET_IDLE);
+		sc->last_report[id] = lr;
+	}
+	sc->rcheck_ready = true;
+}
+
+/*
+ * Devices which ignore SET_IDLE resend unchanged reports at their idle rate.
+ * Check if the report is a byte-identical copy of the previous report with
+ * the same ID. Copies are suppressed only after the device has proven to
+ * ignore SET_IDLE by sending several of them in a row or is quirked so.
+ */
+static bool
+hidbus_is_dup_report(struct hidbus_softc *sc, const uint8_t *buf,
+    hid_size_t len)
+{
+	struct hidbus_last_report *lr;
+
+	lr = sc->last_report[sc->rcheck_has_id ? buf[0] : 0];
+	if (lr == NULL || len > lr->maxlen)
+		return (false);
+
+	if (lr->len != len || memcmp(lr->data, buf, len) != 0) {
+		memcpy(lr->data, buf, len);
+		lr->len = len;
+		lr->repeats = 0;
+		return (false);
+	}
+
+	if (!lr->dedup && ++lr->repeats < HIDBUS_DEDUP_PROOF)
+		return (false);
+	lr->dedup = true;
+	sc->dups++;
+
+	return (true);
+}
+
+static bool
+hidbus_rcheck(struct hidbus_softc *sc, const uint8_t *buf, hid_size_t len)
+{
+	uint8_t id;
+
+	id = sc->rcheck_has_id ? buf[0] : 0;
+	if (sc->rsizes[id] != 0 && len >= sc->rsizes[id])
+		return (true);
+
+	sc->rrejects[id]++;
+	DPRINTFN(5, "malformed report: id=%u len=%u expected=%u\n",
+	    id, len, sc->rsizes[id]);
+	return (false);
+}
+
+static int
+hidbus_rcheck_sysctl(SYSCTL_HANDLER_ARGS)
+{
+	struct hidbus_softc *sc = arg1;
+	struct sbuf *sb;
+	int error, id;
+	bool first = true;
+
+	sb = sbuf_new_for_sysctl(NULL, NULL, 128, req);
+	for (id = 0; id < HID_NREPORT_IDS; id++) {
+		if (sc->rsizes[id] == 0 && sc->rrejects[id] == 0)
+			continue;
+		if (arg2 == 0)
+			sbuf_printf(sb, "%s%d:%u", first ? "" : " ", id,
+			    sc->rsizes[id]);
+		else
+			sbuf_printf(sb, "%s%d:%ju", first ? "" : " ", id,
+			    (uintmax_t)sc->rrejects[id]);
+		first = false;
+	}
+	error = sbuf_finish(sb);
+	sbuf_delete(sb);
+
+	return (error);
+}
+
+static void
+hidbus_tap_unmute(struct hidbus_tap *tap)
+{
+
+	tap->muted = false;
+	tap->win_calls = 0;
+	tap->win_overruns = 0;
+}
+
+static int
+hidbus_taps_unmute_sysctl(SYSCTL_HANDLER_ARGS)
+{
+	struct hidbus_softc *sc = arg1;
+	struct hidbus_tap *tap;
+	int error, val = 0;
+
+	error = sysctl_handle_int(oidp, &val, 0, req);
+	if (error != 0 || req->newptr == NULL || val == 0)
+		return (error);
+
+	if (sc->lock != NULL) {
+		mtx_lock(sc->lock);
+		STAILQ_FOREACH(tap, &sc->taps, link)
+			hidbus_tap_unmute(tap);
+		mtx_unlock(sc->lock);
+	}
+
+	return (0);
+}
+
+static int
+hidbus_taps_sysctl(SYSCTL_HANDLER_ARGS)
+{
+	struct hidbus_softc *sc = arg1;
+	struct hidbus_tap *tap;
+	struct sbuf *sb;
+	int error;
+
+	sb = sbuf_new_for_sysctl(NULL, NULL, 128, req);
+	if (sc->lock != NULL) {
+		mtx_lock(sc->lock);
+		STAILQ_FOREACH(tap, &sc->taps, link)
+			sbuf_printf(sb, "\n%s: calls=%ju overruns=%ju%s",
+			    tap->name, (uintmax_t)tap->calls,
+			    (uintmax_t)tap->overruns,
+			    tap->muted ? " muted" : "");
+		mtx_unlock(sc->lock);
+	}
+	error = sbuf_finish(sb);
+	sbuf_delete(sb);
+
+	return (error);
+}
+
+#ifdef HAVE_BUS_DELAYED_ATTACH_CHILDREN
+/*
+ * bus_delayed_attach_children() defers attach to an interrupt config hook
+ * or runs it immediately after boot. Hooks are run in establishment order
+ * so the attach phase is timed with a pair of hooks around it.
+ */
+static void
+hidbus_attach_begin(void *arg)
+{
+	struct hidbus_softc *sc = device_get_softc(arg);
+
+	sc->attach_start = sbinuptime();
+}
+
+static void
+hidbus_attach_end(void *arg)
+{
+	struct hidbus_softc *sc = device_get_softc(arg);
+
+	sc->phase_us[HIDBUS_PHASE_ATTACH] = HIDBUS_SINCE_US(sc->attach_start);
+}
+#endif
+
+/*
+ * bus_generic_attach() replacement which records per-child probe and
+ * attach time.
+ */
+static int
+hidbus_attach_tlcs(device_t dev)
+{
+	struct hidbus_softc *sc = device_get_softc(dev);
+	struct hidbus_ivars *tlc;
+	device_t *children;
+	sbintime_t start, child_start;
+	int i, nchildren;
+
+	start = sbinuptime();
+	if (device_get_children(dev, &children, &nchildren) != 0)
+		return (0);
+	for (i = 0; i < nchildren; i++) {
+		if (device_is_attached(children[i]))
+			continue;
+		child_start = sbinuptime();
+		device_probe_and_attach(children[i]);
+		tlc = device_get_ivars(children[i]);
+		tlc->attach_us = HIDBUS_SINCE_US(child_start);
+	}
+	free(children, M_TEMP);
+	sc->phase_us[HIDBUS_PHASE_ATTACH] = HIDBUS_SINCE_US(start);
+
+	return (0);
+}
+
+static int
+hidbus_phases_sysctl(SYSCTL_HANDLER_ARGS)
+{
+	struct hidbus_softc *sc = arg1;
+	struct sbuf *sb;
+	int error, i;
+
+	sb = sbuf_new_for_sysctl(NULL, NULL, 128, req);
+	for (i = 0; i < HIDBUS_PHASE_CNT; i++)
+		sbuf_printf(sb, "%s%s=%u", i == 0 ? "" : " ",
+		    hidbus_phase_names[i], sc->phase_us[i]);
+	error = sbuf_finish(sb);
+	sbuf_delete(sb);
+
+	return (error);
+}
+
 static int
 hidbus_attach_children(device_t dev)
 {
 	struct hidbus_softc *sc = device_get_softc(dev);
+	sbintime_t start;
 	bool is_sc_kbd;
 	int error;
 
 	/* syscons(4)/vt(4) - compatible drivers must be run under Giant */
 	is_sc_kbd = hid_is_keyboard(sc->rdesc.data, sc->rdesc.len) != 0;
 	sc->lock = is_sc_kbd ? HID_SYSCONS_MTX : &sc->mtx;
+	hidbus_setup_rcheck(sc);
 	HID_INTR_SETUP(device_get_parent(dev), sc->lock, hidbus_intr, sc,
 	    &sc->rdesc);
 
+	start = sbinuptime();
 	error = hidbus_enumerate_children(dev, sc->rdesc.data, sc->rdesc.len);
 	if (error != 0)
 		DPRINTF("failed to enumerate children: error %d\n", error);
+	sc->phase_us[HIDBUS_PHASE_ENUMERATE] = HIDBUS_SINCE_US(start);
 
 	/*
 	 * hidbus_attach_children() can recurse through device_identify->
 	 * hid_set_report_descr() call sequence. Do not perform children
 	 * attach twice in that case.
 	 */
+	start = sbinuptime();
 	sc->nest++;
 	bus_generic_probe(dev);
 	sc->nest--;
 	if (sc->nest != 0)
 		return (0);
+	sc->phase_us[HIDBUS_PHASE_PROBE] = HIDBUS_SINCE_US(start);
 
-	error = 0;
 	if (is_sc_kbd)
-		error = bus_generic_attach(dev);
-	else
+		error = hidbus_attach_tlcs(dev);
+	else {
 #ifdef HAVE_BUS_DELAYED_ATTACH_CHILDREN
+		config_intrhook_oneshot(hidbus_attach_begin, dev);
 		error = bus_delayed_attach_children(dev);
+		config_intrhook_oneshot(hidbus_attach_end, dev);
 #else
-		config_intrhook_oneshot((ich_func_t)bus_generic_attach, dev);
+		error = 0;
+		config_intrhook_oneshot((ich_func_t)hidbus_attach_tlcs, dev);
 #endif
+	}
 	if (error != 0)
 		device_printf(dev, "failed to attach child: error %d\n", error);
 
@@ -273,11 +768,14 @@ hidbus_attach_children(device_t dev)
 static int
 hidbus_detach_children(device_t dev)
 {
+	struct hidbus_softc *sc;
 	device_t *children, bus;
+	sbintime_t start;
 	bool is_bus;
 	int i, error;
 
 	error = 0;
+	start = sbinuptime();
 
 	is_bus = device_get_devclass(dev) == hidbus_devclass;
 	bus = is_bus ? dev : device_get_parent(dev);
@@ -289,6 +787,8 @@ hidbus_detach_children(device_t dev)
 		/* If hidbus is passed, delete all children. */
 		bus_generic_detach(bus);
 		device_delete_children(bus);
+		sc = device_get_softc(bus);
+		sc->phase_us[HIDBUS_PHASE_DETACH] = HIDBUS_SINCE_US(start);
 	} else {
 		/*
 		 * If hidbus child is passed, delete all hidbus children
@@ -318,6 +818,30 @@ hidbus_detach_children(device_t dev)
 	return (error);
 }
 
+/*
+ * Recreate all children of hidbus to let drivers pick up quirk table changes
+ * which are checked at probe or attach time only.
+ */
+int
+hidbus_reattach_children(device_t bus)
+{
+	struct hidbus_softc *sc = device_get_softc(bus);
+	int error;
+
+	GIANT_REQUIRED;
+
+	KASSERT(device_get_devclass(bus) == hidbus_devclass,
+	    ("Device is not hidbus"));
+
+	error = hidbus_detach_children(bus);
+	if (error != 0)
+		return (error);
+
+	sc->nowrite = hid_test_quirk(device_get_ivars(bus), HQ_NOWRITE);
+
+	return (hidbus_attach_children(bus));
+}
+
 static int
 hidbus_probe(device_t dev)
 {
@@ -335,16 +859,63 @@ hidbus_attach(device_t dev)
 	struct hid_device_info *devinfo = device_get_ivars(dev);
 	void *d_ptr = NULL;
 	hid_size_t d_len;
+	sbintime_t start;
 	int error;
 
 	sc->dev = dev;
 	STAILQ_INIT(&sc->tlcs);
+	STAILQ_INIT(&sc->taps);
 	mtx_init(&sc->mtx, "hidbus lock", NULL, MTX_DEF);
+	sc->stats_tree = SYSCTL_ADD_NODE(device_get_sysctl_ctx(dev),
+	    SYSCTL_CHILDREN(device_get_sysctl_tree(dev)), OID_AUTO, "stats",
+	    CTLFLAG_RD, NULL, "Per child device statistics");
+
+	sc->rcheck = HIDBUS_RCHECK_COUNT;
+	sc->rsizes = malloc(HID_NREPORT_IDS * sizeof(sc->rsizes[0]),
+	    M_DEVBUF, M_WAITOK | M_ZERO);
+	sc->rrejects = malloc(HID_NREPORT_IDS * sizeof(sc->rrejects[0]),
+	    M_DEVBUF, M_WAITOK | M_ZERO);
+	sc->last_report = malloc(HID_NREPORT_IDS * sizeof(sc->last_report[0]),
+	    M_DEVBUF, M_WAITOK | M_ZERO);
+	SYSCTL_ADD_U64(device_get_sysctl_ctx(dev),
+	    SYSCTL_CHILDREN(device_get_sysctl_tree(dev)), OID_AUTO,
+	    "dup_reports", CTLFLAG_RD, &sc->dups, 0,
+	    "Repeated input reports suppressed");
+	SYSCTL_ADD_INT(device_get_sysctl_ctx(dev),
+	    SYSCTL_CHILDREN(device_get_sysctl_tree(dev)), OID_AUTO,
+	    "report_check", CTLFLAG_RWTUN, &sc->rcheck, 0,
+	    "Input report length check: 0 - off, 1 - count, 2 - drop");
+	SYSCTL_ADD_PROC(device_get_sysctl_ctx(dev),
+	    SYSCTL_CHILDREN(device_get_sysctl_tree(dev)), OID_AUTO,
+	    "report_sizes", CTLTYPE_STRING | CTLFLAG_RD, sc, 0,
+	    hidbus_rcheck_sysctl, "A", "Expected input report sizes by ID");
+	SYSCTL_ADD_PROC(device_get_sysctl_ctx(dev),
+	    SYSCTL_CHILDREN(device_get_sysctl_tree(dev)), OID_AUTO,
+	    "report_rejects", CTLTYPE_STRING | CTLFLAG_RD, sc, 1,
+	    hidbus_rcheck_sysctl, "A", "Malformed input reports by ID");
+	SYSCTL_ADD_PROC(device_get_sysctl_ctx(dev),
+	    SYSCTL_CHILDREN(device_get_sysctl_tree(dev)), OID_AUTO,
+	    "taps", CTLTYPE_STRING | CTLFLAG_RD, sc, 0,
+	    hidbus_taps_sysctl, "A", "Input report observers");
+	SYSCTL_ADD_PROC(device_get_sysctl_ctx(dev),
+	    SYSCTL_CHILDREN(device_get_sysctl_tree(dev)), OID_AUTO,
+	    "taps_unmute", CTLTYPE_INT | CTLFLAG_WR, sc, 0,
+	    hidbus_taps_unmute_sysctl, "I",
+	    "Write non-zero to unmute input report observers");
+	SYSCTL_ADD_PROC(device_get_sysctl_ctx(dev),
+	    SYSCTL_CHILDREN(device_get_sysctl_tree(dev)), OID_AUTO,
+	    "attach_times", CTLTYPE_STRING | CTLFLAG_RD, sc, 0,
+	    hidbus_phases_sysctl, "A",
+	    "Last attach, detach and reconfiguration phase times, us");
+
+	/* Resolve device quirks once. Drivers test them as bitmap after. */
+	hid_quirk_attach(devinfo);
 
 	/*
 	 * Ignore error. It is possible to emulate HID device on top of
 	 * non-HID one through overloading of report descriptor.
 	 */
+	start = sbinuptime();
 	d_len = devinfo->rdescsize;
 	if (d_len != 0) {
 		d_ptr = malloc(d_len, M_DEVBUF, M_ZERO | M_WAITOK);
@@ -355,8 +926,11 @@ hidbus_attach(device_t dev)
 			d_ptr = NULL;
 		}
 	}
+	sc->phase_us[HIDBUS_PHASE_RDESC] = HIDBUS_SINCE_US(start);
 
+	start = sbinuptime();
 	hidbus_fill_rdesc_info(&sc->rdesc, d_ptr, d_len);
+	sc->phase_us[HIDBUS_PHASE_RDESC_INFO] = HIDBUS_SINCE_US(start);
 
 	sc->nowrite = hid_test_quirk(devinfo, HQ_NOWRITE);
 
@@ -373,14 +947,31 @@ static int
 hidbus_detach(device_t dev)
 {
 	struct hidbus_softc *sc = device_get_softc(dev);
+	struct hid_device_info *devinfo = device_get_ivars(dev);
 
+	KASSERT(STAILQ_EMPTY(&sc->taps), ("hidbus: observers registered"));
 	hidbus_detach_children(dev);
+	hid_quirk_detach(devinfo);
 	mtx_destroy(&sc->mtx);
 	free(sc->rdesc.data, M_DEVBUF);
+	free(sc->rsizes, M_DEVBUF);
+	free(sc->rrejects, M_DEVBUF);
+	if (sc->last_report != NULL) {
+		hidbus_free_last_reports(sc);
+		free(sc->last_report, M_DEVBUF);
+	}
 
 	return (0);
 }
 
+static void
+hidbus_child_detached(device_t bus, device_t child)
+{
+	struct hidbus_ivars *tlc = device_get_ivars(child);
+
+	hidbus_stats_sysctl_fini(tlc);
+}
+
 static void
 hidbus_child_deleted(device_t bus, device_t child)
 {
@@ -392,6 +983,7 @@ hidbus_child_deleted(device_t bus, device_t child)
 	mtx_lock(sc->lock);
 	STAILQ_REMOVE(&sc->tlcs, tlc, hidbus_ivars, link);
 	mtx_unlock(sc->lock);
+	hidbus_stats_fini(tlc);
 	free(tlc, M_DEVBUF);
 }
 
@@ -521,27 +1113,146 @@ hidbus_find_child(device_t bus, int32_t usage)
 	return (child);
 }
 
+/*
+ * Pass input report to observers. Each observer call is timed and the
+ * observer is muted once it exceeds its budget HIDBUS_TAP_MAX_OVERRUNS
+ * times within HIDBUS_TAP_WINDOW calls, whether in a row or not.
+ */
+static void
+hidbus_run_taps(struct hidbus_softc *sc, const void *buf, hid_size_t len)
+{
+	struct hidbus_tap *tap;
+	sbintime_t start, spent;
+
+	STAILQ_FOREACH(tap, &sc->taps, link) {
+		if (tap->muted)
+			continue;
+		start = sbinuptime();
+		tap->handler(tap->context, buf, len);
+		spent = sbinuptime() - start;
+		tap->calls++;
+		if (++tap->win_calls >= HIDBUS_TAP_WINDOW) {
+			tap->win_calls = 0;
+			tap->win_overruns = 0;
+		}
+		if (spent <= tap->budget)
+			continue;
+		tap->overruns++;
+		if (++tap->win_overruns >= HIDBUS_TAP_MAX_OVERRUNS) {
+			tap->muted = true;
+			device_printf(sc->dev, "observer %s muted: %jd us "
+			    "exceeds %jd us budget\n", tap->name,
+			    (intmax_t)sbttous(spent),
+			    (intmax_t)sbttous(tap->budget));
+		}
+	}
+}
+
 void
 hidbus_intr(void *context, void *buf, hid_size_t len)
 {
 	struct hidbus_softc *sc = context;
 	struct hidbus_ivars *tlc;
+	bool dup;
 
 	mtx_assert(sc->lock, MA_OWNED);
 
 	/*
-	 * Broadcast input report to all subscribers.
+	 * Validate report length against report descriptor once for all
+	 * children. Zero length reports are transport notifications.
+	 */
+	if (sc->rcheck != HIDBUS_RCHECK_OFF && sc->rcheck_ready && len != 0 &&
+	    !hidbus_rcheck(sc, buf, len) && sc->rcheck == HIDBUS_RCHECK_DROP)
+		return;
+
+	if (!STAILQ_EMPTY(&sc->taps))
+		hidbus_run_taps(sc, buf, len);
+
+	dup = hidbus_dedup != 0 && sc->rcheck_ready && len != 0 &&
+	    hidbus_is_dup_report(sc, buf, len);
+
+	/*
+	 * Broadcast input report to all subscribers. Repeated reports are
+	 * still passed to raw consumers like hidraw(4).
 	 * TODO: Add check for input report ID.
 	 */
 	 STAILQ_FOREACH(tlc, &sc->tlcs, link) {
+		if (dup && (tlc->flags & HIDBUS_FLAG_RAW) == 0)
+			continue;
 		if (tlc->open) {
 			KASSERT(tlc->intr_handler != NULL,
 			    ("hidbus: interrupt handler is NULL"));
+			counter_u64_add(tlc->stats[HIDBUS_STAT_REPORTS], 1);
+			counter_u64_add(tlc->stats[HIDBUS_STAT_BYTES], len);
 			tlc->intr_handler(tlc->intr_ctx, buf, len);
 		}
 	}
 }
 
+void
+hidbus_stat_add(device_t child, enum hidbus_stat stat, uint64_t inc)
+{
+	struct hidbus_ivars *tlc = device_get_ivars(child);
+
+	counter_u64_add(tlc->stats[stat], inc);
+}
+
+/*
+ * Record time spent by child driver in evdev device registration. start is
+ * the sbinuptime() value taken right before evdev_register_mtx() call.
+ */
+void
+hidbus_stat_evdev_register(device_t child, sbintime_t start)
+{
+	struct hidbus_ivars *tlc = device_get_ivars(child);
+
+	tlc->evdev_us = HIDBUS_SINCE_US(start);
+}
+
+/*
+ * Register input report observer on hidbus device. budget_us limits time
+ * spent in handler per report, 0 selects default. Observers must be
+ * unregistered before hidbus device is detached.
+ */
+struct hidbus_tap *
+hidbus_tap_register(device_t bus, const char *name, hidbus_tap_t *handler,
+    void *context, u_int budget_us)
+{
+	struct hidbus_softc *sc;
+	struct hidbus_tap *tap;
+
+	if (device_get_devclass(bus) != hidbus_devclass ||
+	    !device_is_attached(bus))
+		return (NULL);
+	sc = device_get_softc(bus);
+
+	tap = malloc(sizeof(*tap), M_DEVBUF, M_WAITOK | M_ZERO);
+	tap->handler = handler;
+	tap->context = context;
+	tap->name = name;
+	tap->budget = (budget_us != 0 ? budget_us : HIDBUS_TAP_BUDGET_DEF) *
+	    SBT_1US;
+
+	mtx_lock(sc->lock);
+	STAILQ_INSERT_TAIL(&sc->taps, tap, link);
+	mtx_unlock(sc->lock);
+
+	return (tap);
+}
+
+void
+hidbus_tap_unregister(device_t bus, struct hidbus_tap *tap)
+{
+	struct hidbus_softc *sc = device_get_softc(bus);
+
+	/* Handler is not running on return as it is called with lock held */
+	mtx_lock(sc->lock);
+	STAILQ_REMOVE(&sc->taps, tap, hidbus_tap, link);
+	mtx_unlock(sc->lock);
+
+	free(tap, M_DEVBUF);
+}
+
 void
 hidbus_set_intr(device_t child, hid_intr_t *handler, void *context)
 {
@@ -549,6 +1260,7 @@ hidbus_set_intr(device_t child, hid_intr_t *handler, void *context)
 
 	tlc->intr_handler = handler;
 	tlc->intr_ctx = context;
+	hidbus_stats_sysctl_init(device_get_parent(child), tlc);
 }
 
 int
@@ -567,6 +1279,9 @@ hidbus_intr_start(device_t child)
 			tlc->open = true;
 	}
 
+	/* Pass first report after (re)open unconditionally */
+	hidbus_reset_last_reports(sc);
+
 	if (open)
 		return (0);
 
@@ -660,6 +1375,7 @@ hid_set_report_descr(device_t dev, const void *data, hid_size_t len)
 	struct hid_rdesc_info rdesc;
 	device_t bus;
 	struct hidbus_softc *sc;
+	sbintime_t start;
 	bool is_bus;
 	int error;
 
@@ -679,6 +1395,7 @@ hid_set_report_descr(device_t dev, const void *data, hid_size_t len)
 	DPRINTFN(5, "len=%d\n", len);
 	DPRINTFN(5, "data = %*D\n", len, data, " ");
 
+	start = sbinuptime();
 	error = hidbus_fill_rdesc_info(&rdesc, data, len);
 	if (error != 0)
 		return (error);
@@ -695,6 +1412,7 @@ hid_set_report_descr(device_t dev, const void *data, hid_size_t len)
 	bcopy(&rdesc, &sc->rdesc, sizeof(struct hid_rdesc_info));
 
 	error = hidbus_attach_children(bus);
+	sc->phase_us[HIDBUS_PHASE_REENUMERATE] = HIDBUS_SINCE_US(start);
 
 	return (error);
 }
@@ -835,6 +1553,7 @@ static device_method_t hidbus_methods[] = {
 
 	/* bus interface */
 	DEVMETHOD(bus_add_child,	hidbus_add_child),
+	DEVMETHOD(bus_child_detached,	hidbus_child_detached),
 	DEVMETHOD(bus_child_deleted,	hidbus_child_deleted),
 	DEVMETHOD(bus_read_ivar,	hidbus_read_ivar),
 	DEVMETHOD(bus_write_ivar,	hidbus_write_ivar),
@@ -32,6 +32,7 @@ enum {
 	HIDBUS_IVAR_FLAGS,
 #define	HIDBUS_FLAG_AUTOCHILD	(0<<1)	/* Child is autodiscovered */
 #define	HIDBUS_FLAG_CAN_POLL	(1<<1)	/* Child can work during panic */
+#define	HIDBUS_FLAG_RAW		(2<<1)	/* Child gets repeated reports */
 	HIDBUS_IVAR_DRIVER_INFO,
 };
 
@@ -43,6 +44,23 @@ HIDBUS_ACCESSOR(index,		INDEX,		uint8_t)
 HIDBUS_ACCESSOR(flags,		FLAGS,		uint32_t)
 HIDBUS_ACCESSOR(driver_info,	DRIVER_INFO,	uintptr_t)
 
+/* Per child device rate meters */
+enum hidbus_stat {
+	HIDBUS_STAT_REPORTS,	/* Input reports delivered to child */
+	HIDBUS_STAT_BYTES,	/* Bytes of input reports delivered */
+	HIDBUS_STAT_EVENTS,	/* evdev event frames emitted by child */
+	HIDBUS_STAT_DROPS,	/* Input reports discarded by child */
+	HIDBUS_STAT_CNT,
+};
+
+/*
+ * Input report observer. Called synchronously from interrupt handler with
+ * hidbus lock held for every input report before it is passed to children.
+ * Report data must not be modified or referenced after return.
+ */
+typedef void hidbus_tap_t(void *context, const void *data, hid_size_t len);
+struct hidbus_tap;
+
 /*
  * The following structure is used when looking up an HID driver for
  * an HID device. It is inspired by the structure called "usb_device_id".
@@ -187,6 +205,12 @@ int		hidbus_intr_stop(device_t);
 void		hidbus_intr_poll(device_t);
 void		hidbus_set_desc(device_t, const char *);
 device_t	hidbus_find_child(device_t, int32_t);
+int		hidbus_reattach_children(device_t);
+void		hidbus_stat_add(device_t, enum hidbus_stat, uint64_t);
+void		hidbus_stat_evdev_register(device_t, sbintime_t);
+struct hidbus_tap *hidbus_tap_register(device_t, const char *,
+		    hidbus_tap_t *, void *, u_int);
+void		hidbus_tap_unregister(device_t, struct hidbus_tap *);
 
 /* hidbus HID interface */
 int	hid_get_report_descr(device_t, void **, hid_size_t *);
@@ -52,7 +52,8 @@ __FBSDID("$FreeBSD$");
 
 #ifdef HID_DEBUG
 #define DPRINTFN(hm, n, fmt, ...) do {					\
-	if ((hm)->debug_var != NULL && *(hm)->debug_var >= (n)) {	\
+	if (__predict_false((hm)->debug_var != NULL &&			\
+	    *(hm)->debug_var >= (n))) {					\
 		device_printf((hm)->dev, "%s: " fmt,			\
 		    __FUNCTION__ ,##__VA_ARGS__);			\
 	}								\
@@ -110,6 +111,102 @@ hidmap_get_next_map_item(struct hidmap *hm, u_int *map, u_int *item,
 	return (hm->map[*map] + *item);
 }
 
+/*
+ * Usage to map item index. Used at probe and attach stages to avoid
+ * scanning of all map items for every HID item usage. Entries with the
+ * same usage keep map order so the first match is the same as with
+ * linear scan.
+ */
+struct hidmap_uent {
+	int32_t		usage;		/* Map item usage + usage offset */
+	uint16_t	map;		/* Index in scatter-gather list */
+	uint16_t	item;		/* Index in map */
+	uint16_t	uoff;		/* Usage offset */
+};
+
+struct hidmap_uidx {
+	struct hidmap_uent	*ents;
+	u_int			nents;
+};
+
+#define	HIDMAP_UIDX_FOREACH(idx, ue, umin, umax)			\
+	for ((ue) = (idx)->ents + hidmap_uidx_lookup((idx), (umin));	\
+	    (ue) < (idx)->ents + (idx)->nents && (ue)->usage <= (umax);	\
+	    (ue)++)
+
+static int
+hidmap_uent_cmp(const void *a, const void *b)
+{
+	const struct hidmap_uent *ua = a, *ub = b;
+
+	if (ua->usage != ub->usage)
+		return (ua->usage < ub->usage ? -1 : 1);
+	if (ua->map != ub->map)
+		return (ua->map - ub->map);
+	if (ua->item != ub->item)
+		return (ua->item - ub->item);
+	return (ua->uoff - ub->uoff);
+}
+
+static void
+hidmap_uidx_build(struct hidmap_uidx *idx,
+    const struct hidmap_item * const *map, const uint32_t *nitems_map,
+    int nmaps)
+{
+	struct hidmap_uent *ue;
+	u_int i, j, m, n = 0;
+
+	/* Finalizing callbacks do not match HID items */
+	for (m = 0; m < nmaps; m++)
+		for (i = 0; i < nitems_map[m]; i++)
+			if (!map[m][i].final_cb)
+				n += MAX(map[m][i].nusages, 1);
+
+	ue = idx->ents = malloc(MAX(n, 1) * sizeof(struct hidmap_uent),
+	    M_DEVBUF, M_WAITOK);
+	for (m = 0; m < nmaps; m++) {
+		for (i = 0; i < nitems_map[m]; i++) {
+			if (map[m][i].final_cb)
+				continue;
+			for (j = 0; j < MAX(map[m][i].nusages, 1); j++, ue++) {
+				ue->usage = map[m][i].usage + j;
+				ue->map = m;
+				ue->item = i;
+				ue->uoff = j;
+			}
+		}
+	}
+	idx->nents = n;
+
+	qsort(idx->ents, idx->nents, sizeof(struct hidmap_uent),
+	    hidmap_uent_cmp);
+}
+
+static void
+hidmap_uidx_free(struct hidmap_uidx *idx)
+{
+	free(idx->ents, M_DEVBUF);
+	idx->ents = NULL;
+	idx->nents = 0;
+}
+
+/* Return position of the first entry with usage not less than given one */
+static u_int
+hidmap_uidx_lookup(const struct hidmap_uidx *idx, int32_t usage)
+{
+	u_int lo = 0, hi = idx->nents, mid;
+
+	while (lo < hi) {
+		mid = (lo + hi) / 2;
+		if (idx->ents[mid].usage < usage)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return (lo);
+}
+
 void
 _hidmap_set_debug_var(struct hidmap *hm, int *debug_var)
 {
@@ -189,17 +286,51 @@ hidmap_sync_keys(struct hidmap *hm)
 	bzero(hm->key_rel, howmany(KEY_CNT, 8));
 }
 
-void
-hidmap_intr(void *context, void *buf, hid_size_t len)
+/*
+ * Apply deadzone around rest position of absolute axis and suppress changes
+ * smaller than hysteresis value. Returns true if value is to be dropped.
+ */
+static inline bool
+hidmap_filter_abs(struct hidmap *hm, struct hidmap_hid_item *hi,
+    int32_t *data)
+{
+	int32_t center;
+
+	/* Drivers mark one-directional axes like triggers and pedals */
+	center = hi->rest_at_min
+	    ? hi->lmin
+	    : ((int64_t)hi->lmin + hi->lmax) / 2;
+	if (hi->flat != 0 && abs(*data - center) <= hi->flat) {
+		if (*data != center && center == hi->last_val)
+			hm->abs_suppressed++;
+		*data = center;
+	}
+
+	/* Always pass values reaching rest position or range limits */
+	if (hi->fuzz != 0 && *data != hi->last_val && *data != center &&
+	    *data != hi->lmin && *data != hi->lmax &&
+	    abs(*data - hi->last_val) < hi->fuzz) {
+		hm->abs_suppressed++;
+		return (true);
+	}
+
+	return (false);
+}
+
+/*
+ * Translate input report to evdev events.
+ * Returns true if an evdev frame has been synced.
+ */
+bool
+hidmap_push_report(struct hidmap *hm, void *buf, hid_size_t len)
 {
-	struct hidmap *hm = context;
 	struct hidmap_hid_item *hi;
 	const struct hidmap_item *mi;
 	int32_t usage;
 	int32_t data;
 	uint16_t key, uoff;
 	uint8_t id = 0;
-	bool found, do_sync = false;
+	bool found, do_sync = false, own_id = false;
 
 	mtx_assert(hidbus_get_lock(hm->dev), MA_OWNED);
 
@@ -207,7 +338,7 @@ hidmap_intr(void *context, void *buf, hid_size_t len)
 	DPRINTFN(hm, 6, "data = %*D\n", len, buf, " ");
 
 	/* Strip leading "report ID" byte */
-	if (hm->hid_items[0].id) {
+	if (hm->intr_has_rid) {
 		id = *(uint8_t *)buf;
 		len--;
 		buf = (uint8_t *)buf + 1;
@@ -230,6 +361,7 @@ hidmap_intr(void *context, void *buf, hid_size_t len)
 		/* Ignore irrelevant reports */
 		if (id != hi->id)
 			continue;
+		own_id = true;
 
 		/*
 		 * 5.8. If Logical Minimum and Logical Maximum are both
@@ -238,8 +370,8 @@ hidmap_intr(void *context, void *buf, hid_size_t len)
 		 * signed values represented in 2’s complement format.
 		 */
 		data = hi->lmin < 0 || hi->lmax < 0
-		    ? hid_get_data(buf, len, &hi->loc)
-		    : hid_get_udata(buf, len, &hi->loc);
+		    ? hid_get_data_cls(buf, len, &hi->loc, hi->loc_class)
+		    : hid_get_udata_cls(buf, len, &hi->loc, hi->loc_class);
 
 		DPRINTFN(hm, 6, "type=%d data=%d item=%*D\n", hi->type, data,
 		    (int)sizeof(hi->cb), &hi->cb, " ");
@@ -266,6 +398,9 @@ hidmap_intr(void *context, void *buf, hid_size_t len)
 				continue;
 			/* FALLTHROUGH */
 		case HIDMAP_TYPE_VARIABLE:
+			if (hm->abs_filter && hi->evtype == EV_ABS &&
+			    hidmap_filter_abs(hm, hi, &data))
+				continue;
 			/*
 			 * Ignore reports for absolute data if the data did not
 			 * change and for relative data if data is 0.
@@ -347,7 +482,20 @@ report_key:
 		if (HIDMAP_WANT_MERGE_KEYS(hm))
 			hidmap_sync_keys(hm);
 		evdev_sync(hm->evdev);
+		hidbus_stat_add(hm->dev, HIDBUS_STAT_EVENTS, 1);
+	} else if (own_id) {
+		/* Reports of sibling TLCs are not drops */
+		hidbus_stat_add(hm->dev, HIDBUS_STAT_DROPS, 1);
 	}
+
+	return (do_sync);
+}
+
+void
+hidmap_intr(void *context, void *buf, hid_size_t len)
+{
+
+	(void)hidmap_push_report(context, buf, len);
 }
 
 static inline bool
@@ -397,19 +545,16 @@ can_map_arr_list(struct hid_item *hi, const struct hidmap_item *mi,
 
 static bool
 hidmap_probe_hid_item(struct hid_item *hi, const struct hidmap_item *map,
-    int nitems_map, hidmap_caps_t caps)
+    const struct hidmap_uidx *idx, hidmap_caps_t caps)
 {
+	const struct hidmap_uent *ue;
 	int32_t arr_size, usage;
 	u_int i, j;
-	uint16_t uoff;
 	bool found = false;
 
-#define	HIDMAP_FOREACH_INDEX(map, nitems, idx, uoff)	\
-	for ((idx) = 0, (uoff) = -1;			\
-	     hidmap_get_next_map_index((map), (nitems), &(idx), &(uoff));)
-
-	HIDMAP_FOREACH_INDEX(map, nitems_map, i, uoff) {
-		if (can_map_callback(hi, map + i, uoff)) {
+	HIDMAP_UIDX_FOREACH(idx, ue, hi->usage, hi->usage) {
+		i = ue->item;
+		if (can_map_callback(hi, map + i, ue->uoff)) {
 			if (map[i].cb(NULL, NULL,
 			    (union hidmap_cb_ctx){.hi = hi}) != 0)
 				break;
@@ -419,8 +564,9 @@ hidmap_probe_hid_item(struct hid_item *hi, const struct hidmap_item *map,
 	}
 
 	if (hi->flags & HIO_VARIABLE) {
-		HIDMAP_FOREACH_INDEX(map, nitems_map, i, uoff) {
-			if (can_map_variable(hi, map + i, uoff)) {
+		HIDMAP_UIDX_FOREACH(idx, ue, hi->usage, hi->usage) {
+			i = ue->item;
+			if (can_map_variable(hi, map + i, ue->uoff)) {
 				KASSERT(map[i].type == EV_KEY ||
 					map[i].type == EV_REL ||
 					map[i].type == EV_ABS ||
@@ -434,9 +580,10 @@ hidmap_probe_hid_item(struct hid_item *hi, const struct hidmap_item *map,
 	}
 
 	if (hi->usage_minimum != 0 || hi->usage_maximum != 0) {
-		HIDMAP_FOREACH_INDEX(map, nitems_map, i, uoff) {
-			if (can_map_arr_range(hi, map + i, uoff)) {
-				setbit(caps, i);
+		HIDMAP_UIDX_FOREACH(idx, ue, hi->usage_minimum,
+		    hi->usage_maximum) {
+			if (can_map_arr_range(hi, map + ue->item, ue->uoff)) {
+				setbit(caps, ue->item);
 				found = true;
 			}
 		}
@@ -455,9 +602,10 @@ hidmap_probe_hid_item(struct hid_item *hi, const struct hidmap_item *map,
 		if (j != 0)
 			break;
 		usage = hi->usage;
-		HIDMAP_FOREACH_INDEX(map, nitems_map, i, uoff) {
-			if (can_map_arr_list(hi, map + i, usage, uoff)) {
-				setbit(caps, i);
+		HIDMAP_UIDX_FOREACH(idx, ue, usage, usage) {
+			if (can_map_arr_list(hi, map + ue->item, usage,
+			    ue->uoff)) {
+				setbit(caps, ue->item);
 				found = true;
 			}
 		}
@@ -470,9 +618,11 @@ static uint32_t
 hidmap_probe_hid_descr(void *d_ptr, hid_size_t d_len, uint8_t tlc_index,
     const struct hidmap_item *map, int nitems_map, hidmap_caps_t caps)
 {
+	struct hidmap_uidx idx;
 	struct hid_data *hd;
 	struct hid_item hi;
 	uint32_t i, items = 0;
+	uint32_t nitems_idx = nitems_map;
 	bool do_free = false;
 
 	if (caps == NULL) {
@@ -481,6 +631,8 @@ hidmap_probe_hid_descr(void *d_ptr, hid_size_t d_len, uint8_t tlc_index,
 	} else
 		bzero (caps, HIDMAP_CAPS_SZ(nitems_map));
 
+	hidmap_uidx_build(&idx, &map, &nitems_idx, 1);
+
 	/* Parse inputs */
 	hd = hid_start_parse(d_ptr, d_len, 1 << hid_input);
 	HIDBUS_FOREACH_ITEM(hd, &hi, tlc_index) {
@@ -489,11 +641,13 @@ hidmap_probe_hid_descr(void *d_ptr, hid_size_t d_len, uint8_t tlc_index,
 		if (hi.flags & HIO_CONST)
 			continue;
 		for (i = 0; i < hi.loc.count; i++, hi.loc.pos += hi.loc.size)
-			if (hidmap_probe_hid_item(&hi, map, nitems_map, caps))
+			if (hidmap_probe_hid_item(&hi, map, &idx, caps))
 				items++;
 	}
 	hid_end_parse(hd);
 
+	hidmap_uidx_free(&idx);
+
 	/* Take finalizing callbacks in to account */
 	for (i = 0; i < nitems_map; i++) {
 		if (map[i].has_cb && map[i].final_cb &&
@@ -558,9 +712,10 @@ hidmap_add_map(struct hidmap *hm, const struct hidmap_item *map,
 }
 
 static bool
-hidmap_parse_hid_item(struct hidmap *hm, struct hid_item *hi,
-    struct hidmap_hid_item *item)
+hidmap_parse_hid_item(struct hidmap *hm, const struct hidmap_uidx *idx,
+    struct hid_item *hi, struct hidmap_hid_item *item)
 {
+	const struct hidmap_uent *ue;
 	const struct hidmap_item *mi;
 	struct hidmap_hid_item hi_temp;
 	int32_t arr_size, usage;
@@ -568,7 +723,11 @@ hidmap_parse_hid_item(struct hidmap *hm, struct hid_item *hi,
 	uint16_t uoff;
 	bool found = false;
 
-	HIDMAP_FOREACH_ITEM(hm, mi, uoff) {
+#define	HIDMAP_UENT_ITEM(hm, ue, mi, uoff)				\
+	((mi) = (hm)->map[(ue)->map] + (ue)->item, (uoff) = (ue)->uoff)
+
+	HIDMAP_UIDX_FOREACH(idx, ue, hi->usage, hi->usage) {
+		HIDMAP_UENT_ITEM(hm, ue, mi, uoff);
 		if (can_map_callback(hi, mi, uoff)) {
 			bzero(&hi_temp, sizeof(hi_temp));
 			hi_temp.cb = mi->cb;
@@ -586,7 +745,8 @@ hidmap_parse_hid_item(struct hidmap *hm, struct hid_item *hi,
 	}
 
 	if (hi->flags & HIO_VARIABLE) {
-		HIDMAP_FOREACH_ITEM(hm, mi, uoff) {
+		HIDMAP_UIDX_FOREACH(idx, ue, hi->usage, hi->usage) {
+			HIDMAP_UENT_ITEM(hm, ue, mi, uoff);
 			if (can_map_variable(hi, mi, uoff)) {
 				item->evtype = mi->type;
 				item->code = mi->code + uoff;
@@ -595,6 +755,9 @@ hidmap_parse_hid_item(struct hidmap *hm, struct hid_item *hi,
 				    : HIDMAP_TYPE_VARIABLE;
 				item->last_val = 0;
 				item->invert_value = mi->invert_value;
+				item->rest_at_min = mi->rest_at_min;
+				item->fuzz = mi->fuzz;
+				item->flat = mi->flat;
 				switch (mi->type) {
 				case EV_KEY:
 					hidmap_support_key(hm, item->code);
@@ -629,7 +792,9 @@ hidmap_parse_hid_item(struct hidmap *hm, struct hid_item *hi,
 	}
 
 	if (hi->usage_minimum != 0 || hi->usage_maximum != 0) {
-		HIDMAP_FOREACH_ITEM(hm, mi, uoff) {
+		HIDMAP_UIDX_FOREACH(idx, ue, hi->usage_minimum,
+		    hi->usage_maximum) {
+			HIDMAP_UENT_ITEM(hm, ue, mi, uoff);
 			if (can_map_arr_range(hi, mi, uoff)) {
 				hidmap_support_key(hm, mi->code + uoff);
 				found = true;
@@ -655,7 +820,8 @@ hidmap_parse_hid_item(struct hidmap *hm, struct hid_item *hi,
 		if (i != 0)
 			break;
 		usage = hi->usage;
-		HIDMAP_FOREACH_ITEM(hm, mi, uoff) {
+		HIDMAP_UIDX_FOREACH(idx, ue, usage, usage) {
+			HIDMAP_UENT_ITEM(hm, ue, mi, uoff);
 			if (can_map_arr_list(hi, mi, usage, uoff)) {
 				hidmap_support_key(hm, mi->code + uoff);
 				if (item->codes == NULL)
@@ -677,6 +843,7 @@ mapped:
 	item->id = hi->report_ID;
 	item->loc = hi->loc;
 	item->loc.count = 1;
+	item->loc_class = hid_loc_class(&item->loc);
 	item->lmin = hi->logical_minimum;
 	item->lmax = hi->logical_maximum;
 
@@ -692,6 +859,7 @@ hidmap_parse_hid_descr(struct hidmap *hm, uint8_t tlc_index)
 {
 	const struct hidmap_item *map;
 	struct hidmap_hid_item *item = hm->hid_items;
+	struct hidmap_uidx idx;
 	void *d_ptr;
 	struct hid_data *hd;
 	struct hid_item hi;
@@ -705,21 +873,31 @@ hidmap_parse_hid_descr(struct hidmap *hm, uint8_t tlc_index)
 		return (error);
 	}
 
+	hidmap_uidx_build(&idx, hm->map, hm->nmap_items, hm->nmaps);
+
 	/* Parse inputs */
 	hd = hid_start_parse(d_ptr, d_len, 1 << hid_input);
 	HIDBUS_FOREACH_ITEM(hd, &hi, tlc_index) {
 		if (hi.kind != hid_input)
 			continue;
+		/*
+		 * Look at all input items as TLC can be handled with
+		 * finalizing callbacks only.
+		 */
+		if (hi.report_ID != 0)
+			hm->intr_has_rid = true;
 		if (hi.flags & HIO_CONST)
 			continue;
 		for (i = 0; i < hi.loc.count; i++, hi.loc.pos += hi.loc.size)
-			if (hidmap_parse_hid_item(hm, &hi, item))
+			if (hidmap_parse_hid_item(hm, &idx, &hi, item))
 				item++;
 		KASSERT(item <= hm->hid_items + hm->nhid_items,
 		    ("Parsed HID item array overflow"));
 	}
 	hid_end_parse(hd);
 
+	hidmap_uidx_free(&idx);
+
 	/* Add finalizing callbacks to the end of list */
 	for (i = 0; i < hm->nmaps; i++) {
 		for (map = hm->map[i];
@@ -779,6 +957,7 @@ hidmap_attach(struct hidmap* hm)
 #ifdef HID_DEBUG
 	char tunable[40];
 #endif
+	sbintime_t start;
 	int error;
 
 #ifdef HID_DEBUG
@@ -824,7 +1003,9 @@ hidmap_attach(struct hidmap* hm)
 	evdev_set_methods(hm->evdev, hm->dev, &hm->evdev_methods);
 	hm->cb_state = HIDMAP_CB_IS_RUNNING;
 
+	start = sbinuptime();
 	error = evdev_register_mtx(hm->evdev, hidbus_get_lock(hm->dev));
+	hidbus_stat_evdev_register(hm->dev, start);
 	if (error) {
 		DPRINTF(hm, "error=%d\n", error);
 		hidmap_detach(hm);
@@ -862,6 +1043,42 @@ hidmap_detach(struct hidmap* hm)
 	return (0);
 }
 
+/*
+ * Check that HID items which driver decodes at fixed offsets are located
+ * where the driver expects them to be in device's report descriptor.
+ */
+int
+hidmap_check_layout(device_t dev, const struct hidmap_layout *layout,
+    int nitems_layout)
+{
+	struct hid_location loc;
+	void *d_ptr;
+	hid_size_t d_len;
+	uint8_t id;
+	int error, i;
+
+	error = hid_get_report_descr(dev, &d_ptr, &d_len);
+	if (error != 0) {
+		device_printf(dev, "could not retrieve report descriptor from "
+		    "device: %d\n", error);
+		return (ENXIO);
+	}
+
+	for (i = 0; i < nitems_layout; i++) {
+		if (!hidbus_locate(d_ptr, d_len, layout[i].usage, hid_input,
+		    hidbus_get_index(dev), layout[i].index, &loc, NULL, &id,
+		    NULL) || id != layout[i].id ||
+		    loc.pos != layout[i].pos || loc.size != layout[i].size) {
+			device_printf(dev, "unsupported report layout: usage "
+			    "0x%08x is not at bit %u of report %u\n",
+			    layout[i].usage, layout[i].pos, layout[i].id);
+			return (ENXIO);
+		}
+	}
+
+	return (0);
+}
+
 MODULE_DEPEND(hidmap, hid, 1, 1, 1);
 MODULE_DEPEND(hidmap, evdev, 1, 1, 1);
 MODULE_VERSION(hidmap, 1);
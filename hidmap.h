@@ -98,7 +98,8 @@ struct hidmap_item {
 	bool			has_cb:1;
 	bool			final_cb:1;
 	bool			invert_value:1;
-	u_int			reserved:10;
+	bool			rest_at_min:1;	/* One-directional axis */
+	u_int			reserved:9;
 };
 
 #define	HIDMAP_ANY(_page, _usage, _type, _code)				\
@@ -150,6 +151,23 @@ struct hidmap_item {
 #define	HIDMAP_FINAL_CB(_callback)					\
 	HIDMAP_ANY_CB(0, 0, (_callback)), .final_cb = true
 
+/*
+ * Location of HID item which driver decodes at fixed offset rather than
+ * through hidmap_item. Checked against report descriptor at attach with
+ * hidmap_check_layout().
+ */
+struct hidmap_layout {
+	int32_t		usage;
+	uint8_t		index;	/* Instance of usage within TLC */
+	uint8_t		id;	/* Report ID */
+	uint32_t	pos;	/* bits, report ID byte is not included */
+	uint32_t	size;	/* bits */
+};
+
+#define	HIDMAP_LAYOUT(_page, _usage, _index, _id, _pos, _size)		\
+	{ .usage = HID_USAGE2((_page), (_usage)), .index = (_index),	\
+	  .id = (_id), .pos = (_pos), .size = (_size) }
+
 enum hidmap_type {
 	HIDMAP_TYPE_FINALCB = 0,/* No HID item associated. Runs unconditionally
 				 * at the end of other items processing */
@@ -177,11 +195,15 @@ struct hidmap_hid_item {
 		uint16_t	last_key;	/* Last reported key (array) */
 	};
 	struct hid_location	loc;		/* HID item location */
+	uint8_t			loc_class;	/* HID_LOC_* extractor */
 	int32_t			lmin;		/* HID item logical minimum */
 	int32_t			lmax;		/* HID item logical maximum */
 	enum hidmap_type	type:8;
 	uint8_t			id;		/* Report ID */
 	bool			invert_value;
+	bool			rest_at_min;	/* Deadzone is at lmin */
+	uint16_t		fuzz;		/* Absolute axis hysteresis */
+	uint16_t		flat;		/* Absolute axis deadzone */
 };
 
 struct hidmap {
@@ -210,6 +232,11 @@ struct hidmap {
 	enum hidmap_cb_state	cb_state;
 	void *			intr_buf;
 	hid_size_t		intr_len;
+	bool			intr_has_rid;	/* Reports start with ID */
+
+	/* Enforce fuzz and flat of absolute axes before event generation */
+	bool			abs_filter;
+	uint64_t		abs_suppressed;
 };
 
 typedef	uint8_t *		hidmap_caps_t;
@@ -250,6 +277,7 @@ void	hidmap_support_key(struct hidmap *hm, uint16_t key);
 void	hidmap_push_key(struct hidmap *hm, uint16_t key, int32_t value);
 
 void	hidmap_intr(void *context, void *buf, hid_size_t len);
+bool	hidmap_push_report(struct hidmap *hm, void *buf, hid_size_t len);
 #define	HIDMAP_PROBE(hm, dev, id, map, suffix)				\
 	hidmap_probe((hm), (dev), (id), nitems(id), (map), nitems(map),	\
 	    (suffix), NULL)
@@ -259,5 +287,9 @@ int	hidmap_probe(struct hidmap* hm, device_t dev,
 	    const char *suffix, hidmap_caps_t caps);
 int	hidmap_attach(struct hidmap *hm);
 int	hidmap_detach(struct hidmap *hm);
+#define	HIDMAP_CHECK_LAYOUT(dev, layout)				\
+	hidmap_check_layout((dev), (layout), nitems(layout))
+int	hidmap_check_layout(device_t dev,
+	    const struct hidmap_layout *layout, int nitems_layout);
 
 #endif	/* _HIDMAP_H_ */
@@ -41,12 +41,16 @@
 #include <sys/lock.h>
 #include <sys/mutex.h>
 #include <sys/condvar.h>
+#include <sys/epoch.h>
 #include <sys/sysctl.h>
 #include <sys/sx.h>
 #include <sys/unistd.h>
 #include <sys/callout.h>
 #include <sys/malloc.h>
 #include <sys/priv.h>
+#include <sys/sbuf.h>
+
+#include <machine/atomic.h>
 
 #include <dev/evdev/input.h>
 
@@ -75,7 +79,29 @@ struct hidquirk_entry {
 	uint16_t quirks[HID_SUB_QUIRKS_MAX];
 };
 
-static struct mtx hidquirk_mtx;
+/*
+ * Immutable snapshot of quirk table used for lookups. Entries are grouped
+ * in hash buckets keyed by (bus, vid, pid). Entries which match on vendor
+ * only are kept in separate buckets keyed by (bus, vid). Each bucket is a
+ * [first; last) range of indexes in the entries array.
+ */
+#define	HIDQUIRK_HASH_BITS	6
+#define	HIDQUIRK_HASH_SIZE	(1 << HIDQUIRK_HASH_BITS)
+
+struct hidquirk_table {
+	uint16_t		exact[HIDQUIRK_HASH_SIZE + 1];
+	uint16_t		vendor[HIDQUIRK_HASH_SIZE + 1];
+	uint16_t		nentries;
+	struct hidquirk_entry	entries[];
+};
+
+/*
+ * Serializes quirk table updates. Lookups are lockless and run in the
+ * preemptible global epoch, so superseded tables are freed once all
+ * lookups which might reference them have finished.
+ */
+static struct sx hidquirk_sx;
+static struct hidquirk_table *hidquirk_tbl;
 
 #define	HID_QUIRK_VP(b,v,p,l,h,...) \
   { .bus = (b), .vid = (v), .pid = (p), .lo_rev = (l), .hi_rev = (h), \
@@ -212,6 +238,134 @@ hid_strquirk(const char *str, size_t len)
 	return (x);
 }
 
+static inline u_int
+hidquirk_hash(uint16_t bus, uint16_t vid, uint16_t pid)
+{
+	return (((((uint32_t)vid << 16) | pid) ^ bus) * 0x9E3779B1u >>
+	    (32 - HIDQUIRK_HASH_BITS));
+}
+
+static bool
+hidquirk_is_vendor_only(const struct hidquirk_entry *entry)
+{
+	uint16_t y;
+
+	if (entry->pid != 0)
+		return (false);
+	for (y = 0; y != HID_SUB_QUIRKS_MAX; y++)
+		if (entry->quirks[y] == HQ_MATCH_VENDOR_ONLY)
+			return (true);
+	return (false);
+}
+
+static bool
+hidquirk_is_used(const struct hidquirk_entry *entry)
+{
+	uint16_t y;
+
+	for (y = 0; y != HID_SUB_QUIRKS_MAX; y++)
+		if (entry->quirks[y] != HQ_NONE)
+			return (true);
+	return (false);
+}
+
+/*------------------------------------------------------------------------*
+ *	hidquirk_publish
+ *
+ * Build lookup table from the current content of hidquirks array and
+ * atomically replace the active one.
+ *------------------------------------------------------------------------*/
+static void
+hidquirk_publish(void)
+{
+	struct hidquirk_table *tbl, *old;
+	const struct hidquirk_entry *entry;
+	uint16_t *bucket;
+	uint16_t nentries, nexact, x;
+	u_int h;
+
+	sx_assert(&hidquirk_sx, SA_XLOCKED);
+
+	nentries = 0;
+	for (x = 0; x != HID_DEV_QUIRKS_MAX; x++)
+		if (hidquirk_is_used(hidquirks + x))
+			nentries++;
+
+	tbl = malloc(sizeof(*tbl) + nentries * sizeof(struct hidquirk_entry),
+	    M_DEVBUF, M_WAITOK | M_ZERO);
+	tbl->nentries = nentries;
+
+	/* Count entries per bucket */
+	for (x = 0; x != HID_DEV_QUIRKS_MAX; x++) {
+		entry = hidquirks + x;
+		if (!hidquirk_is_used(entry))
+			continue;
+		if (hidquirk_is_vendor_only(entry))
+			tbl->vendor[hidquirk_hash(entry->bus, entry->vid,
+			    0) + 1]++;
+		else
+			tbl->exact[hidquirk_hash(entry->bus, entry->vid,
+			    entry->pid) + 1]++;
+	}
+
+	/* Convert counters to ranges. Vendor buckets follow exact ones */
+	for (h = 0; h != HIDQUIRK_HASH_SIZE; h++)
+		tbl->exact[h + 1] += tbl->exact[h];
+	nexact = tbl->exact[HIDQUIRK_HASH_SIZE];
+	tbl->vendor[0] = nexact;
+	for (h = 0; h != HIDQUIRK_HASH_SIZE; h++)
+		tbl->vendor[h + 1] += tbl->vendor[h];
+
+	/* Distribute entries. Use range starts as insertion cursors */
+	for (x = 0; x != HID_DEV_QUIRKS_MAX; x++) {
+		entry = hidquirks + x;
+		if (!hidquirk_is_used(entry))
+			continue;
+		if (hidquirk_is_vendor_only(entry)) {
+			h = hidquirk_hash(entry->bus, entry->vid, 0);
+			bucket = tbl->vendor;
+		} else {
+			h = hidquirk_hash(entry->bus, entry->vid, entry->pid);
+			bucket = tbl->exact;
+		}
+		tbl->entries[bucket[h]++] = *entry;
+	}
+
+	/* Cursors have been moved to range ends. Shift them back */
+	for (h = HIDQUIRK_HASH_SIZE; h != 0; h--) {
+		tbl->exact[h] = tbl->exact[h - 1];
+		tbl->vendor[h] = tbl->vendor[h - 1];
+	}
+	tbl->exact[0] = 0;
+	tbl->vendor[0] = nexact;
+
+	old = hidquirk_tbl;
+	atomic_store_rel_ptr((volatile uintptr_t *)&hidquirk_tbl,
+	    (uintptr_t)tbl);
+	/* Initial table is published before any device has been attached */
+	if (old != NULL) {
+		epoch_wait_preempt(global_epoch_preempt);
+		free(old, M_DEVBUF);
+		hid_quirk_update();
+	}
+}
+
+static bool
+hidquirk_match_entry(const struct hidquirk_entry *entry,
+    const struct hid_device_info *info, uint16_t quirk)
+{
+	uint16_t y;
+
+	if (entry->lo_rev > info->idVersion || entry->hi_rev < info->idVersion)
+		return (false);
+
+	for (y = 0; y != HID_SUB_QUIRKS_MAX; y++)
+		if (entry->quirks[y] == quirk)
+			return (true);
+
+	return (false);
+}
+
 /*------------------------------------------------------------------------*
  *	hid_test_quirk_by_info
  *
@@ -222,46 +376,49 @@ hid_strquirk(const char *str, size_t len)
 bool
 hid_test_quirk_by_info(const struct hid_device_info *info, uint16_t quirk)
 {
-	uint16_t x;
-	uint16_t y;
+	struct epoch_tracker et;
+	const struct hidquirk_table *tbl;
+	const struct hidquirk_entry *entry;
+	u_int h;
 
 	if (quirk == HQ_NONE)
-		goto done;
+		return (false);
 
-	HID_MTX_LOCK(&hidquirk_mtx);
+	epoch_enter_preempt(global_epoch_preempt, &et);
+	tbl = (const struct hidquirk_table *)atomic_load_acq_ptr(
+	    (volatile uintptr_t *)&hidquirk_tbl);
+	if (tbl == NULL)
+		goto done;
 
-	for (x = 0; x != HID_DEV_QUIRKS_MAX; x++) {
-		/* see if quirk information does not match */
-		if ((hidquirks[x].bus != info->idBus) ||
-		    (hidquirks[x].vid != info->idVendor) ||
-		    (hidquirks[x].lo_rev > info->idVersion) ||
-		    (hidquirks[x].hi_rev < info->idVersion)) {
-			continue;
-		}
-		/* see if quirk only should match vendor ID */
-		if (hidquirks[x].pid != info->idProduct) {
-			if (hidquirks[x].pid != 0)
-				continue;
+	h = hidquirk_hash(info->idBus, info->idVendor, info->idProduct);
+	for (entry = tbl->entries + tbl->exact[h];
+	     entry < tbl->entries + tbl->exact[h + 1];
+	     entry++) {
+		if (entry->bus == info->idBus &&
+		    entry->vid == info->idVendor &&
+		    entry->pid == info->idProduct &&
+		    hidquirk_match_entry(entry, info, quirk))
+			goto found;
+	}
 
-			for (y = 0; y != HID_SUB_QUIRKS_MAX; y++) {
-				if (hidquirks[x].quirks[y] == HQ_MATCH_VENDOR_ONLY)
-					break;
-			}
-			if (y == HID_SUB_QUIRKS_MAX)
-				continue;
-		}
-		/* lookup quirk */
-		for (y = 0; y != HID_SUB_QUIRKS_MAX; y++) {
-			if (hidquirks[x].quirks[y] == quirk) {
-				HID_MTX_UNLOCK(&hidquirk_mtx);
-				DPRINTF("Found quirk '%s'.\n", hidquirkstr(quirk));
-				return (true);
-			}
-		}
+	/* see if quirk only should match vendor ID */
+	h = hidquirk_hash(info->idBus, info->idVendor, 0);
+	for (entry = tbl->entries + tbl->vendor[h];
+	     entry < tbl->entries + tbl->vendor[h + 1];
+	     entry++) {
+		if (entry->bus == info->idBus &&
+		    entry->vid == info->idVendor &&
+		    hidquirk_match_entry(entry, info, quirk))
+			goto found;
 	}
-	HID_MTX_UNLOCK(&hidquirk_mtx);
 done:
+	epoch_exit_preempt(global_epoch_preempt, &et);
 	return (false);			/* no quirk match */
+
+found:
+	epoch_exit_preempt(global_epoch_preempt, &et);
+	DPRINTF("Found quirk '%s'.\n", hidquirkstr(quirk));
+	return (true);
 }
 
 static struct hidquirk_entry *
@@ -270,7 +427,7 @@ hidquirk_get_entry(uint16_t bus, uint16_t vid, uint16_t pid,
 {
 	uint16_t x;
 
-	HID_MTX_ASSERT(&hidquirk_mtx, MA_OWNED);
+	sx_assert(&hidquirk_sx, SA_XLOCKED);
 
 	if ((bus | vid | pid | lo_rev | hi_rev) == 0) {
 		/* all zero - special case */
@@ -316,155 +473,15 @@ hidquirk_get_entry(uint16_t bus, uint16_t vid, uint16_t pid,
 	return (NULL);
 }
 
-#ifdef NOT_YET
-/*------------------------------------------------------------------------*
- *	usb_quirk_ioctl - handle quirk IOCTLs
- *
- * Returns:
- * 0: Success
- * Else: Failure
- *------------------------------------------------------------------------*/
-static int
-hidquirk_ioctl(unsigned long cmd, caddr_t data,
-    int fflag, struct thread *td)
-{
-	struct usb_gen_quirk *pgq;
-	struct usb_quirk_entry *pqe;
-	uint32_t x;
-	uint32_t y;
-	int err;
-
-	switch (cmd) {
-	case USB_DEV_QUIRK_GET:
-		pgq = (void *)data;
-		x = pgq->index % USB_SUB_QUIRKS_MAX;
-		y = pgq->index / USB_SUB_QUIRKS_MAX;
-		if (y >= USB_DEV_QUIRKS_MAX) {
-			return (EINVAL);
-		}
-		USB_MTX_LOCK(&hidquirk_mtx);
-		/* copy out data */
-		pgq->vid = hidquirks[y].vid;
-		pgq->pid = hidquirks[y].pid;
-		pgq->bcdDeviceLow = hidquirks[y].lo_rev;
-		pgq->bcdDeviceHigh = hidquirks[y].hi_rev;
-		strlcpy(pgq->quirkname,
-		    hidquirkstr(hidquirks[y].quirks[x]),
-		    sizeof(pgq->quirkname));
-		USB_MTX_UNLOCK(&hidquirk_mtx);
-		return (0);		/* success */
-
-	case USB_QUIRK_NAME_GET:
-		pgq = (void *)data;
-		x = pgq->index;
-		if (x >= USB_QUIRK_MAX) {
-			return (EINVAL);
-		}
-		strlcpy(pgq->quirkname,
-		    hidquirkstr(x), sizeof(pgq->quirkname));
-		return (0);		/* success */
-
-	case USB_DEV_QUIRK_ADD:
-		pgq = (void *)data;
-
-		/* check privileges */
-		err = priv_check(curthread, PRIV_DRIVER);
-		if (err) {
-			return (err);
-		}
-		/* convert quirk string into numerical */
-		for (y = 0; y != USB_DEV_QUIRKS_MAX; y++) {
-			if (strcmp(pgq->quirkname, hidquirkstr(y)) == 0) {
-				break;
-			}
-		}
-		if (y == USB_DEV_QUIRKS_MAX) {
-			return (EINVAL);
-		}
-		if (y == UQ_NONE) {
-			return (EINVAL);
-		}
-		USB_MTX_LOCK(&hidquirk_mtx);
-		pqe = usb_quirk_get_entry(pgq->vid, pgq->pid,
-		    pgq->bcdDeviceLow, pgq->bcdDeviceHigh, 1);
-		if (pqe == NULL) {
-			USB_MTX_UNLOCK(&hidquirk_mtx);
-			return (EINVAL);
-		}
-		for (x = 0; x != USB_SUB_QUIRKS_MAX; x++) {
-			if (pqe->quirks[x] == UQ_NONE) {
-				pqe->quirks[x] = y;
-				break;
-			}
-		}
-		USB_MTX_UNLOCK(&hidquirk_mtx);
-		if (x == USB_SUB_QUIRKS_MAX) {
-			return (ENOMEM);
-		}
-		return (0);		/* success */
-
-	case USB_DEV_QUIRK_REMOVE:
-		pgq = (void *)data;
-		/* check privileges */
-		err = priv_check(curthread, PRIV_DRIVER);
-		if (err) {
-			return (err);
-		}
-		/* convert quirk string into numerical */
-		for (y = 0; y != USB_DEV_QUIRKS_MAX; y++) {
-			if (strcmp(pgq->quirkname, hidquirkstr(y)) == 0) {
-				break;
-			}
-		}
-		if (y == USB_DEV_QUIRKS_MAX) {
-			return (EINVAL);
-		}
-		if (y == UQ_NONE) {
-			return (EINVAL);
-		}
-		USB_MTX_LOCK(&hidquirk_mtx);
-		pqe = usb_quirk_get_entry(pgq->vid, pgq->pid,
-		    pgq->bcdDeviceLow, pgq->bcdDeviceHigh, 0);
-		if (pqe == NULL) {
-			USB_MTX_UNLOCK(&hidquirk_mtx);
-			return (EINVAL);
-		}
-		for (x = 0; x != USB_SUB_QUIRKS_MAX; x++) {
-			if (pqe->quirks[x] == y) {
-				pqe->quirks[x] = UQ_NONE;
-				break;
-			}
-		}
-		if (x == USB_SUB_QUIRKS_MAX) {
-			USB_MTX_UNLOCK(&hidquirk_mtx);
-			return (ENOMEM);
-		}
-		for (x = 0; x != USB_SUB_QUIRKS_MAX; x++) {
-			if (pqe->quirks[x] != UQ_NONE) {
-				break;
-			}
-		}
-		if (x == USB_SUB_QUIRKS_MAX) {
-			/* all quirk entries are unused - release */
-			memset(pqe, 0, sizeof(*pqe));
-		}
-		USB_MTX_UNLOCK(&hidquirk_mtx);
-		return (0);		/* success */
-
-	default:
-		break;
-	}
-	return (ENOIOCTL);
-}
-#endif
 
 /*------------------------------------------------------------------------*
- *	usb_quirk_strtou16
+ *	hidquirk_strtou16
  *
  * Helper function to scan a 16-bit integer.
  *------------------------------------------------------------------------*/
-static uint16_t
-hidquirk_strtou16(const char **pptr, const char *name, const char *what)
+static bool
+hidquirk_strtou16(const char **pptr, const char *name, const char *what,
+    uint16_t *result)
 {
 	unsigned long value;
 	char *end;
@@ -473,40 +490,41 @@ hidquirk_strtou16(const char **pptr, const char *name, const char *what)
 	if (value > 65535 || *pptr == end || (*end != ' ' && *end != '\t')) {
 		printf("%s: %s 16-bit %s value set to zero\n",
 		    name, what, *end == 0 ? "incomplete" : "invalid");
-		return (0);
+		*result = 0;
+		return (false);
 	}
 	*pptr = end + 1;
-	return ((uint16_t)value);
+	*result = (uint16_t)value;
+	return (true);
 }
 
 /*------------------------------------------------------------------------*
- *	usb_quirk_add_entry_from_str
+ *	hidquirk_parse_entry
+ *
+ * Parse a HID quirk entry from string.
+ *     "BUS VENDOR PRODUCT LO_REV HI_REV QUIRK[,QUIRK[,...]]"
  *
- * Add a USB quirk entry from string.
- *     "VENDOR PRODUCT LO_REV HI_REV QUIRK[,QUIRK[,...]]"
+ * Returns:
+ * 0: Success
+ * Else: Failure. Entry may still be partially filled.
  *------------------------------------------------------------------------*/
-static void
-hidquirk_add_entry_from_str(const char *name, const char *env)
+static int
+hidquirk_parse_entry(const char *name, const char *env,
+    struct hidquirk_entry *entry)
 {
-	struct hidquirk_entry entry = { };
-	struct hidquirk_entry *new;
 	uint16_t quirk_idx;
 	uint16_t quirk;
 	const char *end;
-
-	/* check for invalid environment variable */
-	if (name == NULL || env == NULL)
-		return;
-
-	if (bootverbose)
-		printf("Adding HID QUIRK '%s' = '%s'\n", name, env);
+	bool valid = true;
 
 	/* parse device information */
-	entry.bus = hidquirk_strtou16(&env, name, "Bus ID");
-	entry.vid = hidquirk_strtou16(&env, name, "Vendor ID");
-	entry.pid = hidquirk_strtou16(&env, name, "Product ID");
-	entry.lo_rev = hidquirk_strtou16(&env, name, "Low revision");
-	entry.hi_rev = hidquirk_strtou16(&env, name, "High revision");
+	valid &= hidquirk_strtou16(&env, name, "Bus ID", &entry->bus);
+	valid &= hidquirk_strtou16(&env, name, "Vendor ID", &entry->vid);
+	valid &= hidquirk_strtou16(&env, name, "Product ID", &entry->pid);
+	valid &= hidquirk_strtou16(&env, name, "Low revision",
+	    &entry->lo_rev);
+	valid &= hidquirk_strtou16(&env, name, "High revision",
+	    &entry->hi_rev);
 
 	/* parse quirk information */
 	quirk_idx = 0;
@@ -523,10 +541,11 @@ hidquirk_add_entry_from_str(const char *name, const char *env)
 		/* lookup quirk in string table */
 		quirk = hid_strquirk(env, end - env);
 		if (quirk < HID_QUIRK_MAX) {
-			entry.quirks[quirk_idx++] = quirk;
+			entry->quirks[quirk_idx++] = quirk;
 		} else {
 			printf("%s: unknown HID quirk '%.*s' (skipped)\n",
 			    name, (int)(end - env), env);
+			valid = false;
 		}
 		env = end;
 
@@ -535,24 +554,220 @@ hidquirk_add_entry_from_str(const char *name, const char *env)
 			env++;
 	}
 
+	if (quirk_idx == 0) {
+		printf("%s: No HID quirks found!\n", name);
+		return (EINVAL);
+	}
+	if (*env != 0) {
+		printf("%s: Too many HID quirks, only %d allowed!\n",
+		    name, HID_SUB_QUIRKS_MAX);
+		valid = false;
+	}
+
+	return (valid ? 0 : EINVAL);
+}
+
+/*------------------------------------------------------------------------*
+ *	hidquirk_add_entry_from_str
+ *
+ * Add a HID quirk entry from string.
+ *     "BUS VENDOR PRODUCT LO_REV HI_REV QUIRK[,QUIRK[,...]]"
+ *------------------------------------------------------------------------*/
+static void
+hidquirk_add_entry_from_str(const char *name, const char *env)
+{
+	struct hidquirk_entry entry = { };
+	struct hidquirk_entry *new;
+
+	/* check for invalid environment variable */
+	if (name == NULL || env == NULL)
+		return;
+
+	if (bootverbose)
+		printf("Adding HID QUIRK '%s' = '%s'\n", name, env);
+
+	/* Keep going on malformed values as long as some quirk is parsed */
+	(void)hidquirk_parse_entry(name, env, &entry);
+	if (entry.quirks[0] == HQ_NONE)
+		return;
+
 	/* register quirk */
-	if (quirk_idx != 0) {
-		if (*env != 0) {
-			printf("%s: Too many HID quirks, only %d allowed!\n",
-			    name, HID_SUB_QUIRKS_MAX);
+	sx_xlock(&hidquirk_sx);
+	new = hidquirk_get_entry(entry.bus, entry.vid, entry.pid,
+	    entry.lo_rev, entry.hi_rev, 1);
+	if (new == NULL)
+		printf("%s: HID quirks table is full!\n", name);
+	else
+		memcpy(new->quirks, entry.quirks, sizeof(entry.quirks));
+	sx_xunlock(&hidquirk_sx);
+}
+
+/*------------------------------------------------------------------------*
+ *	Runtime quirk management
+ *
+ * Quirks can be added, removed and listed with sysctl(8) at run time:
+ *     sysctl hw.hid.quirk.add="BUS VENDOR PRODUCT LO_REV HI_REV QUIRK,..."
+ *     sysctl hw.hid.quirk.remove="BUS VENDOR PRODUCT LO_REV HI_REV QUIRK,..."
+ *     sysctl hw.hid.quirk.list
+ * Resolved quirks of attached devices are updated immediately. Quirks
+ * which drivers check at attach time only take effect after the drivers
+ * are reattached. Set hw.hid.quirk.reattach to do it automatically.
+ *------------------------------------------------------------------------*/
+static SYSCTL_NODE(_hw_hid, OID_AUTO, quirk, CTLFLAG_RW, 0,
+    "HID quirk table");
+
+static bool hidquirk_reattach = false;
+SYSCTL_BOOL(_hw_hid_quirk, OID_AUTO, reattach, CTLFLAG_RW,
+    &hidquirk_reattach, 0,
+    "Reattach drivers of devices affected by quirk table changes");
+
+static bool
+hidquirk_match_info(const struct hidquirk_entry *entry,
+    const struct hid_device_info *info)
+{
+
+	if (entry->bus != info->idBus || entry->vid != info->idVendor ||
+	    entry->lo_rev > info->idVersion || entry->hi_rev < info->idVersion)
+		return (false);
+
+	return (entry->pid == info->idProduct ||
+	    hidquirk_is_vendor_only(entry));
+}
+
+static void
+hidquirk_reattach_devices(const struct hidquirk_entry *entry)
+{
+	device_t bus;
+	int unit;
+
+	mtx_lock(&Giant);
+	for (unit = 0; unit < devclass_get_maxunit(hidbus_devclass); unit++) {
+		bus = devclass_get_device(hidbus_devclass, unit);
+		if (bus == NULL || !device_is_attached(bus))
+			continue;
+		if (!hidquirk_match_info(entry, device_get_ivars(bus)))
+			continue;
+		if (bootverbose)
+			device_printf(bus, "reattaching after quirk change\n");
+		hidbus_reattach_children(bus);
+	}
+	mtx_unlock(&Giant);
+}
+
+static int
+hidquirk_sysctl_update(SYSCTL_HANDLER_ARGS)
+{
+	struct hidquirk_entry entry = { };
+	struct hidquirk_entry *pqe, new;
+	char buf[128];
+	bool do_add = arg2 != 0;
+	uint16_t x, y, z;
+	u_int removed = 0;
+	int error;
+
+	buf[0] = '\0';
+	error = sysctl_handle_string(oidp, buf, sizeof(buf), req);
+	if (error != 0 || req->newptr == NULL)
+		return (error);
+
+	error = hidquirk_parse_entry(oidp->oid_name, buf, &entry);
+	if (error != 0)
+		return (error);
+
+	sx_xlock(&hidquirk_sx);
+	pqe = hidquirk_get_entry(entry.bus, entry.vid, entry.pid,
+	    entry.lo_rev, entry.hi_rev, do_add);
+	if (pqe == NULL) {
+		sx_xunlock(&hidquirk_sx);
+		return (do_add ? ENOMEM : ENOENT);
+	}
+
+	/* Apply the request to a copy. Table is changed on success only */
+	new = *pqe;
+	for (y = 0; y != HID_SUB_QUIRKS_MAX && entry.quirks[y] != HQ_NONE;
+	     y++) {
+		z = HID_SUB_QUIRKS_MAX;
+		for (x = 0; x != HID_SUB_QUIRKS_MAX; x++) {
+			if (new.quirks[x] == entry.quirks[y])
+				break;
+			if (new.quirks[x] == HQ_NONE &&
+			    z == HID_SUB_QUIRKS_MAX)
+				z = x;
+		}
+		if (do_add && x == HID_SUB_QUIRKS_MAX) {
+			/* not present yet, take first free slot */
+			if (z == HID_SUB_QUIRKS_MAX) {
+				error = ENOSPC;
+				break;
+			}
+			new.quirks[z] = entry.quirks[y];
+		} else if (!do_add && x != HID_SUB_QUIRKS_MAX) {
+			new.quirks[x] = HQ_NONE;
+			removed++;
+		}
+	}
+	if (!do_add && removed == 0)
+		error = ENOENT;
+
+	if (error == 0)
+		*pqe = new;
+	if (!hidquirk_is_used(pqe)) {
+		/* all quirk entries are unused - release */
+		memset(pqe, 0, sizeof(*pqe));
+	}
+	if (error == 0)
+		hidquirk_publish();
+	sx_xunlock(&hidquirk_sx);
+
+	if (error != 0)
+		return (error);
+
+	if (hidquirk_reattach)
+		hidquirk_reattach_devices(&entry);
+
+	return (0);
+}
+SYSCTL_PROC(_hw_hid_quirk, OID_AUTO, add, CTLTYPE_STRING | CTLFLAG_WR,
+    NULL, 1, hidquirk_sysctl_update, "A",
+    "Add quirks: \"BUS VENDOR PRODUCT LO_REV HI_REV QUIRK,...\"");
+SYSCTL_PROC(_hw_hid_quirk, OID_AUTO, remove, CTLTYPE_STRING | CTLFLAG_WR,
+    NULL, 0, hidquirk_sysctl_update, "A",
+    "Remove quirks: \"BUS VENDOR PRODUCT LO_REV HI_REV QUIRK,...\"");
+
+static int
+hidquirk_sysctl_list(SYSCTL_HANDLER_ARGS)
+{
+	const struct hidquirk_entry *pqe;
+	struct sbuf *sb;
+	uint16_t x, y;
+	bool first;
+	int error;
+
+	sb = sbuf_new_for_sysctl(NULL, NULL, 512, req);
+	sx_slock(&hidquirk_sx);
+	for (x = 0; x != HID_DEV_QUIRKS_MAX; x++) {
+		pqe = hidquirks + x;
+		if (!hidquirk_is_used(pqe))
+			continue;
+		sbuf_printf(sb, "\n0x%02x 0x%04x 0x%04x 0x%04x 0x%04x ",
+		    pqe->bus, pqe->vid, pqe->pid, pqe->lo_rev, pqe->hi_rev);
+		first = true;
+		for (y = 0; y != HID_SUB_QUIRKS_MAX; y++) {
+			if (pqe->quirks[y] == HQ_NONE)
+				continue;
+			sbuf_printf(sb, "%s%s", first ? "" : ",",
+			    hidquirkstr(pqe->quirks[y]));
+			first = false;
 		}
-		HID_MTX_LOCK(&hidquirk_mtx);
-		new = hidquirk_get_entry(entry.bus, entry.vid, entry.pid,
-		    entry.lo_rev, entry.hi_rev, 1);
-		if (new == NULL)
-			printf("%s: HID quirks table is full!\n", name);
-		else
-			memcpy(new->quirks, entry.quirks, sizeof(entry.quirks));
-		HID_MTX_UNLOCK(&hidquirk_mtx);
-	} else {
-		printf("%s: No USB quirks found!\n", name);
 	}
+	sx_sunlock(&hidquirk_sx);
+	error = sbuf_finish(sb);
+	sbuf_delete(sb);
+
+	return (error);
 }
+SYSCTL_PROC(_hw_hid_quirk, OID_AUTO, list, CTLTYPE_STRING | CTLFLAG_RD,
+    NULL, 0, hidquirk_sysctl_list, "A", "List quirk table entries");
 
 static void
 hidquirk_init(void *arg)
@@ -560,8 +775,8 @@ hidquirk_init(void *arg)
 	char envkey[sizeof(HID_QUIRK_ENVROOT) + 2];	/* 2 digits max, 0 to 99 */
 	int i;
   
-	/* initialize mutex */
-	mtx_init(&hidquirk_mtx, "HID quirk", NULL, MTX_DEF);
+	/* initialize lock */
+	sx_init(&hidquirk_sx, "HID quirk");
 
 	/* look for quirks defined by the environment variable */
 	for (i = 0; i != 100; i++) {
@@ -574,21 +789,30 @@ hidquirk_init(void *arg)
 		/* parse environment variable */
 		hidquirk_add_entry_from_str(envkey, kern_getenv(envkey));
 	}
+
+	sx_xlock(&hidquirk_sx);
+	hidquirk_publish();
+	sx_xunlock(&hidquirk_sx);
 	
 	/* register our function */
 	hid_test_quirk_p = &hid_test_quirk_by_info;
-#ifdef NOT_YET
-	hidquirk_ioctl_p = &hidquirk_ioctl;
-#endif
 }
 
 static void
 hidquirk_uninit(void *arg)
 {
+	struct hidquirk_table *tbl;
+
 	hidquirk_unload(arg);
 
-	/* destroy mutex */
-	mtx_destroy(&hidquirk_mtx);
+	/* release lookup table */
+	tbl = hidquirk_tbl;
+	atomic_store_rel_ptr((volatile uintptr_t *)&hidquirk_tbl, 0);
+	epoch_wait_preempt(global_epoch_preempt);
+	free(tbl, M_DEVBUF);
+
+	/* destroy lock */
+	sx_destroy(&hidquirk_sx);
 }
 
 SYSINIT(hidquirk_init, SI_SUB_LOCK, SI_ORDER_FIRST, hidquirk_init, NULL);
@@ -60,7 +60,8 @@
 	HQ(MS_LEADING_BYTE),	/* mouse sends an unknown leading byte */ \
 	HQ(MS_REVZ),		/* mouse has Z-axis reversed */		\
 	HQ(SPUR_BUT_UP),	/* spurious mouse button up events */	\
-	HQ(MT_TIMESTAMP)	/* Multitouch device exports HW timestamps */
+	HQ(MT_TIMESTAMP),	/* Multitouch device exports HW timestamps */ \
+	HQ(NO_SET_IDLE)		/* device misbehaves on SET_IDLE request */
 
 #ifndef	HQ
 #define	HQ(x)	HQ_##x
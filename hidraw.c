@@ -213,6 +213,7 @@ hidraw_attach(device_t self)
 	}
 
 	hidbus_set_intr(sc->sc_dev, hidraw_intr, sc);
+	hidbus_set_flags(self, hidbus_get_flags(self) | HIDBUS_FLAG_RAW);
 
 	return (0);
 }
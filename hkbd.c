@@ -133,6 +133,7 @@ struct hkbd_softc {
 	struct hid_location sc_loc_apple_eject;
 	struct hid_location sc_loc_apple_fn;
 	struct hid_location sc_loc_key[HKBD_NKEYCODE];
+	uint8_t sc_loc_key_class[HKBD_NKEYCODE];
 	struct hid_location sc_loc_numlock;
 	struct hid_location sc_loc_capslock;
 	struct hid_location sc_loc_scrolllock;
@@ -676,8 +677,8 @@ hkbd_intr_callback(void *context, void *data, hid_size_t len)
 			if (tmp_loc.count > HKBD_NKEYCODE)
 				tmp_loc.count = HKBD_NKEYCODE;
 			while (tmp_loc.count--) {
-				uint32_t key =
-				    hid_get_udata(buf, len, &tmp_loc);
+				uint32_t key = hid_get_udata_cls(buf, len,
+				    &tmp_loc, sc->sc_loc_key_class[0]);
 				/* advance to next location */
 				tmp_loc.pos += tmp_loc.size;
 				if (key == KEY_ERROR) {
@@ -698,7 +699,8 @@ hkbd_intr_callback(void *context, void *data, hid_size_t len)
 				bit_set(sc->sc_ndata, key);
 				bit_set(sc->sc_ndata0, key);
 			}
-		} else if (hid_get_data(buf, len, &sc->sc_loc_key[i])) {
+		} else if (hid_get_data_cls(buf, len, &sc->sc_loc_key[i],
+		    sc->sc_loc_key_class[i])) {
 			uint32_t key = i;
 
 			if (modifiers & MOD_FN)
@@ -791,6 +793,9 @@ hkbd_parse_hid(struct hkbd_softc *sc, const uint8_t *ptr, uint32_t len,
 			DPRINTFN(1, "Ignoring keyboard event control\n");
 		} else {
 			bit_set(sc->sc_loc_key_valid, 0);
+			/* Array elements are equally sized and aligned */
+			sc->sc_loc_key_class[0] =
+			    hid_loc_class(&sc->sc_loc_key[0]);
 			DPRINTFN(1, "Found keyboard event array\n");
 		}
 	}
@@ -803,6 +808,8 @@ hkbd_parse_hid(struct hkbd_softc *sc, const uint8_t *ptr, uint32_t len,
 		    &sc->sc_id_loc_key[key], NULL)) {
 			if (flags & HIO_VARIABLE) {
 				bit_set(sc->sc_loc_key_valid, key);
+				sc->sc_loc_key_class[key] =
+				    hid_loc_class(&sc->sc_loc_key[key]);
 				DPRINTFN(1, "Found key 0x%02x\n", key);
 			}
 		}
@@ -859,7 +866,8 @@ hkbd_attach(device_t dev)
 	uint8_t tlc_index = hidbus_get_index(dev);
 #ifdef EVDEV_SUPPORT
 	struct evdev_dev *evdev;
-	int i;
+	sbintime_t start;
+	int error, i;
 #endif
 
 	sc->sc_dev = dev;
@@ -966,7 +974,10 @@ hkbd_attach(device_t dev)
 	if (sc->sc_flags & HKBD_FLAG_SCROLLLOCK)
 		evdev_support_led(evdev, LED_SCROLLL);
 
-	if (evdev_register_mtx(evdev, sc->sc_lock))
+	start = sbinuptime();
+	error = evdev_register_mtx(evdev, sc->sc_lock);
+	hidbus_stat_evdev_register(dev, start);
+	if (error != 0)
 		evdev_free(evdev);
 	else
 		sc->sc_evdev = evdev;
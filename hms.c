@@ -34,8 +34,12 @@ __FBSDID("$FreeBSD$");
 
 #include <sys/param.h>
 #include <sys/bus.h>
+#include <sys/callout.h>
 #include <sys/kernel.h>
+#include <sys/lock.h>
+#include <sys/malloc.h>
 #include <sys/module.h>
+#include <sys/mutex.h>
 #include <sys/sysctl.h>
 
 #include <dev/evdev/input.h>
@@ -142,15 +146,259 @@ struct hms_softc {
 	hid_size_t		isize;
 	uint32_t		drift_cnt;
 	uint32_t		drift_thresh;
+
+	/*
+	 * Relative motion coalescing. Deltas of reports which do not change
+	 * anything but relative axes are summed up for coalesce_us usecs
+	 * and delivered as single evdev frame.
+	 */
+	bool			coalesce_cap;
+	bool			coalesce_gone;
+	uint32_t		coalesce_us;
+	struct callout		coalesce_callout;
+	int32_t			rel_accum[REL_CNT];
+	bool			rel_pending;
+	uint64_t		reports_in;
+	uint64_t		frames_out;
+
+	/* Boot protocol compatible report layout is decoded directly */
+	bool			boot_layout;
+	hid_size_t		boot_len;
 };
 
+/*
+ * Check if input report matches boot protocol mouse layout described in
+ * "Appendix B.2" of HID1_11.pdf with optional wheel in 4-th byte: buttons
+ * in the first byte followed by 8-bit signed X, Y and wheel deltas.
+ */
+static bool
+hms_is_boot_layout(struct hms_softc *sc)
+{
+	struct hidmap *hm = &sc->hm;
+	struct hidmap_hid_item *hi;
+	bool has_x = false, has_y = false;
+	hid_size_t len = 3;
+
+	/* Report ID and key merging require generic processing */
+	if (hm->intr_has_rid || hm->key_rel != NULL)
+		return (false);
+
+	for (hi = hm->hid_items; hi < hm->hid_items + hm->nhid_items; hi++) {
+		if (hi->type != HIDMAP_TYPE_VARIABLE)
+			return (false);
+		if (hi->evtype == EV_KEY) {
+			if (hi->loc.size != 1 || hi->loc.pos >= 8 ||
+			    hi->invert_value)
+				return (false);
+			continue;
+		}
+		if (hi->evtype != EV_REL || hi->loc.size != 8 ||
+		    hi->lmin >= 0)
+			return (false);
+		if (hi->code == REL_X && hi->loc.pos == 8)
+			has_x = true;
+		else if (hi->code == REL_Y && hi->loc.pos == 16)
+			has_y = true;
+		else if (hi->code == REL_WHEEL && hi->loc.pos == 24)
+			len = 4;
+		else
+			return (false);
+	}
+	if (!has_x || !has_y)
+		return (false);
+
+	sc->boot_len = len;
+	return (true);
+}
+
+/*
+ * Same as hidmap_intr() for boot protocol layout, but with fixed offsets
+ * instead of generic HID item location decoding. Emits identical events.
+ * INVARIANTS kernels check every decoded value against generic extractor
+ * used by hidmap_push_report().
+ */
+static bool
+hms_boot_intr(struct hms_softc *sc, const uint8_t *buf)
+{
+	struct hidmap *hm = &sc->hm;
+	struct hidmap_hid_item *hi;
+	int32_t data;
+	bool do_sync = false;
+
+	for (hi = hm->hid_items; hi < hm->hid_items + hm->nhid_items; hi++) {
+		if (hi->evtype == EV_KEY)
+			data = (buf[0] >> hi->loc.pos) & 1;
+		else
+			data = (int8_t)buf[hi->loc.pos / 8];
+		KASSERT(data == (hi->lmin < 0 || hi->lmax < 0 ?
+		    hid_get_data(buf, sc->boot_len, &hi->loc) :
+		    hid_get_udata(buf, sc->boot_len, &hi->loc)),
+		    ("hms: boot layout decoding mismatch: pos %u size %u",
+		    hi->loc.pos, hi->loc.size));
+
+		if (hi->evtype == EV_KEY) {
+			if (data == hi->last_val)
+				continue;
+			evdev_push_key(hm->evdev, hi->code, data);
+			hi->last_val = data;
+		} else {
+			if (data == 0)
+				continue;
+			evdev_push_rel(hm->evdev, hi->code,
+			    hi->invert_value ? -data : data);
+		}
+		do_sync = true;
+	}
+
+	if (do_sync) {
+		evdev_sync(hm->evdev);
+		hidbus_stat_add(hm->dev, HIDBUS_STAT_EVENTS, 1);
+	} else
+		hidbus_stat_add(hm->dev, HIDBUS_STAT_DROPS, 1);
+
+	return (do_sync);
+}
+
+static void
+hms_coalesce_flush(struct hms_softc *sc)
+{
+	int code;
+	bool do_sync = false;
+
+	mtx_assert(hidbus_get_lock(sc->hm.dev), MA_OWNED);
+
+	if (!sc->rel_pending)
+		return;
+
+	for (code = 0; code < REL_CNT; code++) {
+		if (sc->rel_accum[code] != 0) {
+			evdev_push_rel(sc->hm.evdev, code, sc->rel_accum[code]);
+			sc->rel_accum[code] = 0;
+			do_sync = true;
+		}
+	}
+	sc->rel_pending = false;
+
+	/* Accumulated motion may cancel out */
+	if (do_sync) {
+		evdev_sync(sc->hm.evdev);
+		sc->frames_out++;
+		hidbus_stat_add(sc->hm.dev, HIDBUS_STAT_EVENTS, 1);
+	}
+}
+
+/*
+ * Plain relative mice are served by hidmap_intr() directly. hms_intr() is
+ * only installed when it has something to do: drift filtering, boot layout
+ * decoding or motion coalescing.
+ */
+static void
+hms_set_intr(struct hms_softc *sc)
+{
+	bool wrap;
+
+	wrap = sc->iichid_sampling || sc->boot_layout || sc->coalesce_us != 0;
+	hidbus_set_intr(sc->hm.dev, wrap ? hms_intr : hidmap_intr, &sc->hm);
+}
+
+static int
+hms_coalesce_us_sysctl(SYSCTL_HANDLER_ARGS)
+{
+	struct hms_softc *sc = arg1;
+	uint32_t val;
+	int error;
+
+	val = sc->coalesce_us;
+	error = sysctl_handle_32(oidp, &val, 0, req);
+	if (error != 0 || req->newptr == NULL)
+		return (error);
+
+	mtx_lock(hidbus_get_lock(sc->hm.dev));
+	if (!sc->coalesce_gone) {
+		sc->coalesce_us = val;
+		/* Deliver pending motion before hms_intr() is bypassed */
+		if (val == 0) {
+			callout_stop(&sc->coalesce_callout);
+			hms_coalesce_flush(sc);
+		}
+		hms_set_intr(sc);
+	}
+	mtx_unlock(hidbus_get_lock(sc->hm.dev));
+
+	return (0);
+}
+
+static void
+hms_coalesce_timeout(void *context)
+{
+	struct hms_softc *sc = context;
+
+	hms_coalesce_flush(sc);
+}
+
+/*
+ * Sum up relative axes of the report if it does not carry anything else,
+ * like button state changes, which must be delivered immediately.
+ */
+static bool
+hms_coalesce(struct hms_softc *sc, void *buf, hid_size_t len)
+{
+	struct hidmap *hm = &sc->hm;
+	struct hidmap_hid_item *hi;
+	int32_t data;
+	uint8_t id = 0;
+	bool pass;
+
+	if (hm->intr_has_rid) {
+		id = *(uint8_t *)buf;
+		len--;
+		buf = (uint8_t *)buf + 1;
+	}
+
+	/* The first pass validates, the second one accumulates */
+	for (pass = false; ; pass = true) {
+		for (hi = hm->hid_items;
+		     hi < hm->hid_items + hm->nhid_items;
+		     hi++) {
+			if (hi->type == HIDMAP_TYPE_FINALCB || hi->id != id)
+				continue;
+			if (hi->type != HIDMAP_TYPE_VARIABLE &&
+			    hi->type != HIDMAP_TYPE_VAR_NULLST)
+				return (false);
+			data = hi->lmin < 0 || hi->lmax < 0
+			    ? hid_get_data_cls(buf, len, &hi->loc,
+			        hi->loc_class)
+			    : hid_get_udata_cls(buf, len, &hi->loc,
+			        hi->loc_class);
+			if (hi->evtype == EV_REL) {
+				if (pass)
+					sc->rel_accum[hi->code] +=
+					    hi->invert_value ? -data : data;
+				continue;
+			}
+			if (hi->invert_value)
+				data = hi->lmin + hi->lmax - data;
+			if (hi->type == HIDMAP_TYPE_VAR_NULLST &&
+			    (data < hi->lmin || data > hi->lmax))
+				continue;
+			if (data != hi->last_val)
+				return (false);
+		}
+		if (pass)
+			break;
+	}
+
+	return (true);
+}
+
 static void
 hms_intr(void *context, void *buf, hid_size_t len)
 {
 	struct hidmap *hm = context;
 	struct hms_softc *sc = device_get_softc(hm->dev);
+	bool synced;
 
-	if (len > sc->isize)
+	if (sc->iichid_sampling && len > sc->isize)
 		len = sc->isize;
 
 	/*
@@ -159,17 +407,44 @@ hms_intr(void *context, void *buf, hid_size_t len)
 	 * been ended.  That results in cursor drift.  Filter out such a
 	 * reports through comparing with previous one.
 	 */
-	if (len == sc->last_irsize && memcmp(buf, sc->last_ir, len) == 0) {
+	if (!sc->iichid_sampling) {
+		/* Nothing to filter */
+	} else if (len == sc->last_irsize &&
+	    memcmp(buf, sc->last_ir, len) == 0) {
 		sc->drift_cnt++;
-		if (sc->drift_thresh != 0 && sc->drift_cnt >= sc->drift_thresh)
+		if (sc->drift_thresh != 0 &&
+		    sc->drift_cnt >= sc->drift_thresh) {
+			hidbus_stat_add(hm->dev, HIDBUS_STAT_DROPS, 1);
 			return;
+		}
 	} else {
 		sc->drift_cnt = 0;
 		sc->last_irsize = len;
 		bcopy(buf, sc->last_ir, len);
 	}
 
-	hidmap_intr(context, buf, len);
+	sc->reports_in++;
+	if (sc->coalesce_us != 0 && !sc->coalesce_gone) {
+		if (hms_coalesce(sc, buf, len)) {
+			if (!sc->rel_pending) {
+				sc->rel_pending = true;
+				callout_reset_sbt(&sc->coalesce_callout,
+				    SBT_1US * sc->coalesce_us, 0,
+				    hms_coalesce_timeout, sc, 0);
+			}
+			return;
+		}
+		/* Deliver pending motion ahead of button change */
+		callout_stop(&sc->coalesce_callout);
+		hms_coalesce_flush(sc);
+	}
+
+	if (sc->boot_layout && len >= sc->boot_len)
+		synced = hms_boot_intr(sc, buf);
+	else
+		synced = hidmap_push_report(hm, buf, len);
+	if (synced)
+		sc->frames_out++;
 }
 
 static int
@@ -184,9 +459,8 @@ hms_final_cb(HIDMAP_CB_ARGS)
 			evdev_support_prop(evdev, INPUT_PROP_DIRECT);
 		else
 			evdev_support_prop(evdev, INPUT_PROP_POINTER);
-		/* Overload interrupt handler to skip identical reports */
-		if (sc->iichid_sampling)
-			hidbus_set_intr(sc->hm.dev, hms_intr, &sc->hm);
+		/* Overload interrupt handler if needed */
+		hms_set_intr(sc);
 	}
 
 	/* Do not execute callback at interrupt handler and detach */
@@ -288,10 +562,40 @@ hms_attach(device_t dev)
 		    "drift detection threshhold");
 	}
 
+	if (hidmap_test_cap(sc->caps, HMS_REL_X) &&
+	    hidmap_test_cap(sc->caps, HMS_REL_Y)) {
+		sc->coalesce_cap = true;
+		callout_init_mtx(&sc->coalesce_callout, hidbus_get_lock(dev),
+		    0);
+		SYSCTL_ADD_PROC(device_get_sysctl_ctx(dev),
+		    SYSCTL_CHILDREN(device_get_sysctl_tree(dev)), OID_AUTO,
+		    "coalesce_us", CTLTYPE_U32 | CTLFLAG_RW, sc, 0,
+		    hms_coalesce_us_sysctl, "IU",
+		    "Relative motion coalescing window, usecs. 0 - disabled");
+		SYSCTL_ADD_U64(device_get_sysctl_ctx(dev),
+		    SYSCTL_CHILDREN(device_get_sysctl_tree(dev)), OID_AUTO,
+		    "reports_in", CTLFLAG_RD, &sc->reports_in, 0,
+		    "Number of input reports received");
+		SYSCTL_ADD_U64(device_get_sysctl_ctx(dev),
+		    SYSCTL_CHILDREN(device_get_sysctl_tree(dev)), OID_AUTO,
+		    "frames_out", CTLFLAG_RD, &sc->frames_out, 0,
+		    "Number of evdev frames delivered");
+	}
+
 	error = hidmap_attach(&sc->hm);
 	if (error)
 		return (error);
 
+	/* Boot layout is decoded by hms_intr() with fixed offsets */
+	if (sc->coalesce_cap && hms_is_boot_layout(sc)) {
+		mtx_lock(hidbus_get_lock(dev));
+		sc->boot_layout = true;
+		hms_set_intr(sc);
+		mtx_unlock(hidbus_get_lock(dev));
+		if (bootverbose)
+			device_printf(dev, "boot protocol report layout\n");
+	}
+
 	/* Count number of input usages of variable type mapped to buttons */
 	for (hi = sc->hm.hid_items;
 	     hi < sc->hm.hid_items + sc->hm.nhid_items;
@@ -321,6 +625,14 @@ hms_detach(device_t dev)
 	struct hms_softc *sc = device_get_softc(dev);
 	int error;
 
+	if (sc->coalesce_cap) {
+		mtx_lock(hidbus_get_lock(dev));
+		sc->coalesce_gone = true;
+		callout_stop(&sc->coalesce_callout);
+		mtx_unlock(hidbus_get_lock(dev));
+		callout_drain(&sc->coalesce_callout);
+	}
+
 	error = hidmap_detach(&sc->hm);
 	if (error == 0)
 		free(sc->last_ir, M_DEVBUF);
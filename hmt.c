@@ -185,7 +185,9 @@ struct hmt_softc {
 
 	struct hid_absinfo	ai[HMT_N_USAGES];
 	struct hid_location	locs[MAX_MT_SLOTS][HMT_N_USAGES];
+	uint8_t			loc_classes[MAX_MT_SLOTS][HMT_N_USAGES];
 	struct hid_location	cont_count_loc;
+	uint8_t			cont_count_class;
 	struct hid_location	btn_loc[HMT_BTN_MAX];
 	struct hid_location	int_btn_loc;
 	struct hid_location	scan_time_loc;
@@ -309,6 +311,7 @@ hmt_attach(device_t dev)
 	uint32_t cont_count_max;
 	int nbuttons, btn;
 	size_t i;
+	sbintime_t start;
 	int err;
 
 	err = hid_get_report_descr(dev, &d_ptr, &d_len);
@@ -431,7 +434,9 @@ hmt_attach(device_t dev)
 			    sc->ai[i].min, sc->ai[i].max, 0, 0, sc->ai[i].res);
 	}
 
+	start = sbinuptime();
 	err = evdev_register_mtx(sc->evdev, hidbus_get_lock(sc->dev));
+	hidbus_stat_evdev_register(dev, start);
 	if (err) {
 		hmt_detach(dev);
 		return (ENXIO);
@@ -524,7 +529,8 @@ hmt_intr(void *context, void *buf, hid_size_t len)
 	 * report with contactid=0 but contactids are zero-based, find
 	 * contactcount first.
 	 */
-	cont_count = hid_get_udata(buf, len, &sc->cont_count_loc);
+	cont_count = hid_get_udata_cls(buf, len, &sc->cont_count_loc,
+	    sc->cont_count_class);
 	/*
 	 * "In Hybrid mode, the number of contacts that can be reported in one
 	 * report is less than the maximum number of contacts that the device
@@ -544,7 +550,7 @@ hmt_intr(void *context, void *buf, hid_size_t len)
 
 #ifdef HID_DEBUG
 	DPRINTFN(6, "cont_count:%2u", (unsigned)cont_count);
-	if (hmt_debug >= 6) {
+	if (__predict_false(hmt_debug >= 6)) {
 		HMT_FOREACH_USAGE(sc->caps, usage) {
 			if (hmt_hid_map[usage].usage != HMT_NO_USAGE)
 				printf(" %-4s", hmt_hid_map[usage].name);
@@ -561,8 +567,9 @@ hmt_intr(void *context, void *buf, hid_size_t len)
 		bzero(slot_data, sizeof(sc->slot_data));
 		HMT_FOREACH_USAGE(sc->caps, usage) {
 			if (sc->locs[cont][usage].size > 0)
-				slot_data[usage] = hid_get_udata(
-				    buf, len, &sc->locs[cont][usage]);
+				slot_data[usage] = hid_get_udata_cls(
+				    buf, len, &sc->locs[cont][usage],
+				    sc->loc_classes[cont][usage]);
 		}
 
 		slot = evdev_get_mt_slot_by_tracking_id(sc->evdev,
@@ -570,7 +577,7 @@ hmt_intr(void *context, void *buf, hid_size_t len)
 
 #ifdef HID_DEBUG
 		DPRINTFN(6, "cont%01x: data = ", cont);
-		if (hmt_debug >= 6) {
+		if (__predict_false(hmt_debug >= 6)) {
 			HMT_FOREACH_USAGE(sc->caps, usage) {
 				if (hmt_hid_map[usage].usage != HMT_NO_USAGE)
 					printf("%04x ", slot_data[usage]);
@@ -646,6 +653,7 @@ hmt_intr(void *context, void *buf, hid_size_t len)
 						 &sc->btn_loc[btn]) != 0);
 		}
 		evdev_sync(sc->evdev);
+		hidbus_stat_add(sc->dev, HIDBUS_STAT_EVENTS, 1);
 	}
 }
 
@@ -860,6 +868,13 @@ hmt_hid_parse(struct hmt_softc *sc, const void *d_ptr, hid_size_t d_len,
 	sc->nconts_per_report = cont;
 	sc->has_int_button = has_int_button;
 
+	/* Pick up fast extractors for fields fetched on every report */
+	for (cont = 0; cont < sc->nconts_per_report; cont++)
+		for (i = 0; i < HMT_N_USAGES; i++)
+			sc->loc_classes[cont][i] =
+			    hid_loc_class(&sc->locs[cont][i]);
+	sc->cont_count_class = hid_loc_class(&sc->cont_count_loc);
+
 	return (type);
 }
 
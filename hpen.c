@@ -39,7 +39,9 @@ __FBSDID("$FreeBSD$");
 #include <sys/param.h>
 #include <sys/bus.h>
 #include <sys/kernel.h>
+#include <sys/lock.h>
 #include <sys/module.h>
+#include <sys/mutex.h>
 #include <sys/sysctl.h>
 
 #include <dev/evdev/input.h>
@@ -57,6 +59,8 @@ static const uint8_t	hpen_graphire_report_descr[] =
 static const uint8_t	hpen_graphire3_4x5_report_descr[] =
 			   { UHID_GRAPHIRE3_4X5_REPORT_DESCR() };
 
+static hid_intr_t	hpen_intr;
+
 static hidmap_cb_t	hpen_battery_strenght_cb;
 static hidmap_cb_t	hpen_final_digi_cb;
 static hidmap_cb_t	hpen_final_pen_cb;
@@ -111,21 +115,85 @@ static const struct hid_device_id hpen_devs[] = {
 	{ HID_TLC(HUP_DIGITIZERS, HUD_PEN) },
 };
 
+#define	HPEN_BATTERY_INTERVAL_DEF	60	/* seconds */
+
+struct hpen_softc {
+	struct hidmap		hm;
+
+	/*
+	 * Proximity gating. Reports received while the pen stays out of
+	 * range carry no useful data and are dropped before decoding.
+	 */
+	bool			prox_gating;
+	bool			in_range;
+	uint8_t			prox_id;
+	struct hid_location	prox_loc;
+	uint64_t		suppressed;
+
+	/* Battery strength, percents. Sampled once per battery_interval */
+	bool			battery_cap;
+	int			battery;
+	int			battery_ticks;
+	u_int			battery_interval;
+};
+
+static void
+hpen_intr(void *context, void *buf, hid_size_t len)
+{
+	struct hidmap *hm = context;
+	struct hpen_softc *sc = device_get_softc(hm->dev);
+	uint8_t *data = buf;
+	hid_size_t dlen = len;
+	bool in_range;
+
+	if (!sc->prox_gating)
+		goto dispatch;
+
+	/* Reports without In Range usage are not gated */
+	if (hm->intr_has_rid) {
+		if (dlen == 0 || *data != sc->prox_id)
+			goto dispatch;
+		data++;
+		dlen--;
+	}
+
+	in_range = hid_get_udata(data, dlen, &sc->prox_loc) != 0;
+	if (!in_range && !sc->in_range) {
+		sc->suppressed++;
+		hidbus_stat_add(hm->dev, HIDBUS_STAT_DROPS, 1);
+		return;
+	}
+	/* Out of range transition report is passed to release the tool */
+	sc->in_range = in_range;
+
+dispatch:
+	hidmap_intr(hm, buf, len);
+}
+
 static int
 hpen_battery_strenght_cb(HIDMAP_CB_ARGS)
 {
-	struct evdev_dev *evdev = HIDMAP_CB_GET_EVDEV();
-	int32_t data;
+	struct hpen_softc *sc = HIDMAP_CB_GET_SOFTC();
+	int32_t data, range;
 
 	switch (HIDMAP_CB_GET_STATE()) {
 	case HIDMAP_CB_IS_ATTACHING:
-		evdev_support_event(evdev, EV_PWR);
-		/* TODO */
+		/* evdev has no battery event, report level with sysctl */
+		sc->battery_cap = true;
 		break;
 	case HIDMAP_CB_IS_RUNNING:
-		data = ctx.data;
-		/* TODO */
-		break;
+		if (sc->battery < 0 || (u_int)(ticks - sc->battery_ticks) >=
+		    sc->battery_interval * hz) {
+			data = ctx.data;
+			range = hi->lmax - hi->lmin;
+			if (range > 0 && data >= hi->lmin && data <= hi->lmax) {
+				sc->battery =
+				    (int64_t)(data - hi->lmin) * 100 / range;
+				sc->battery_ticks = ticks;
+			}
+		}
+		/* Battery level does not generate evdev events */
+		return (ENOSYS);
 	default:
 		break;
 	}
@@ -136,10 +204,13 @@ hpen_battery_strenght_cb(HIDMAP_CB_ARGS)
 static int
 hpen_final_digi_cb(HIDMAP_CB_ARGS)
 {
+	struct hpen_softc *sc = HIDMAP_CB_GET_SOFTC();
 	struct evdev_dev *evdev = HIDMAP_CB_GET_EVDEV();
 
-	if (HIDMAP_CB_GET_STATE() == HIDMAP_CB_IS_ATTACHING)
+	if (HIDMAP_CB_GET_STATE() == HIDMAP_CB_IS_ATTACHING) {
 		evdev_support_prop(evdev, INPUT_PROP_POINTER);
+		hidbus_set_intr(sc->hm.dev, hpen_intr, &sc->hm);
+	}
 
 	/* Do not execute callback at interrupt handler and detach */
 	return (ENOSYS);
@@ -148,10 +219,13 @@ hpen_final_digi_cb(HIDMAP_CB_ARGS)
 static int
 hpen_final_pen_cb(HIDMAP_CB_ARGS)
 {
+	struct hpen_softc *sc = HIDMAP_CB_GET_SOFTC();
 	struct evdev_dev *evdev = HIDMAP_CB_GET_EVDEV();
 
-	if (HIDMAP_CB_GET_STATE() == HIDMAP_CB_IS_ATTACHING)
+	if (HIDMAP_CB_GET_STATE() == HIDMAP_CB_IS_ATTACHING) {
 		evdev_support_prop(evdev, INPUT_PROP_DIRECT);
+		hidbus_set_intr(sc->hm.dev, hpen_intr, &sc->hm);
+	}
 
 	/* Do not execute callback at interrupt handler and detach */
 	return (ENOSYS);
@@ -206,11 +280,32 @@ hpen_probe(device_t dev)
 	return (BUS_PROBE_DEFAULT);
 }
 
+/*
+ * Look up In Range usage mapped to BTN_TOOL_PEN to gate reports on it.
+ */
+static bool
+hpen_find_prox(struct hpen_softc *sc)
+{
+	struct hidmap *hm = &sc->hm;
+	struct hidmap_hid_item *hi;
+
+	for (hi = hm->hid_items; hi < hm->hid_items + hm->nhid_items; hi++) {
+		if (hi->type == HIDMAP_TYPE_VARIABLE &&
+		    hi->evtype == EV_KEY && hi->code == BTN_TOOL_PEN) {
+			sc->prox_id = hi->id;
+			sc->prox_loc = hi->loc;
+			return (true);
+		}
+	}
+
+	return (false);
+}
+
 static int
 hpen_attach(device_t dev)
 {
 	const struct hid_device_info *hw = hid_get_device_info(dev);
-	struct hidmap *hm = device_get_softc(dev);
+	struct hpen_softc *sc = device_get_softc(dev);
 	int error;
 
 	if (hw->idBus == BUS_USB && hw->idVendor == USB_VENDOR_WACOM &&
@@ -228,13 +323,44 @@ hpen_attach(device_t dev)
 			    "error=%d (ignored)\n", error);
 	}
 
-	return (hidmap_attach(hm));
+	sc->battery = -1;
+	sc->battery_interval = HPEN_BATTERY_INTERVAL_DEF;
+
+	error = hidmap_attach(&sc->hm);
+	if (error)
+		return (error);
+
+	/* Pen is considered in range until first report tells otherwise */
+	mtx_lock(hidbus_get_lock(dev));
+	sc->in_range = true;
+	sc->prox_gating = hpen_find_prox(sc);
+	mtx_unlock(hidbus_get_lock(dev));
+
+	if (sc->prox_gating)
+		SYSCTL_ADD_U64(device_get_sysctl_ctx(dev),
+		    SYSCTL_CHILDREN(device_get_sysctl_tree(dev)), OID_AUTO,
+		    "suppressed", CTLFLAG_RD, &sc->suppressed, 0,
+		    "Number of reports dropped while pen is out of range");
+	if (sc->battery_cap) {
+		SYSCTL_ADD_INT(device_get_sysctl_ctx(dev),
+		    SYSCTL_CHILDREN(device_get_sysctl_tree(dev)), OID_AUTO,
+		    "battery", CTLFLAG_RD, &sc->battery, 0,
+		    "Pen battery strength, percents. -1 - unknown");
+		SYSCTL_ADD_UINT(device_get_sysctl_ctx(dev),
+		    SYSCTL_CHILDREN(device_get_sysctl_tree(dev)), OID_AUTO,
+		    "battery_interval", CTLFLAG_RW, &sc->battery_interval, 0,
+		    "Battery strength sampling interval, seconds");
+	}
+
+	return (0);
 }
 
 static int
 hpen_detach(device_t dev)
 {
-	return (hidmap_detach(device_get_softc(dev)));
+	struct hpen_softc *sc = device_get_softc(dev);
+
+	return (hidmap_detach(&sc->hm));
 }
 
 
@@ -248,7 +374,7 @@ static device_method_t hpen_methods[] = {
 	DEVMETHOD_END
 };
 
-DEFINE_CLASS_0(hpen, hpen_driver, hpen_methods, sizeof(struct hidmap));
+DEFINE_CLASS_0(hpen, hpen_driver, hpen_methods, sizeof(struct hpen_softc));
 DRIVER_MODULE(hpen, hidbus, hpen_driver, hpen_devclass, NULL, 0);
 MODULE_DEPEND(hpen, hid, 1, 1, 1);
 MODULE_DEPEND(hpen, hidmap, 1, 1, 1);
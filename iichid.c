@@ -30,13 +30,17 @@ __FBSDID("$FreeBSD$");
 #include <sys/param.h>
 #include <sys/bus.h>
 #include <sys/callout.h>
+#include <sys/cpuset.h>
 #include <sys/endian.h>
 #include <sys/kernel.h>
 #include <sys/lock.h>
 #include <sys/malloc.h>
 #include <sys/module.h>
 #include <sys/mutex.h>
+#include <sys/priority.h>
 #include <sys/rman.h>
+#include <sys/sbuf.h>
+#include <sys/smp.h>
 #include <sys/sysctl.h>
 #include <sys/systm.h>
 #include <sys/sx.h>
@@ -59,14 +63,14 @@ __FBSDID("$FreeBSD$");
 #include "hidquirk.h"
 
 #ifdef IICHID_DEBUG
-static int iichid_debug = 1;
+static int iichid_debug = 0;
 
 static SYSCTL_NODE(_hw, OID_AUTO, iichid, CTLFLAG_RW, 0, "I2C HID");
 SYSCTL_INT(_hw_iichid, OID_AUTO, debug, CTLFLAG_RWTUN,
     &iichid_debug, 1, "Debug level");
 
 #define	DPRINTFN(sc, n, ...) do {			\
-	if (iichid_debug >= (n))			\
+	if (__predict_false(iichid_debug >= (n)))	\
 		device_printf((sc)->dev, __VA_ARGS__);	\
 } while (0)
 #define	DPRINTF(sc, ...)	DPRINTFN((sc), 1, __VA_ARGS__)
@@ -109,6 +113,17 @@ enum {
 #define	IICHID_SAMPLING_RATE_SLOW	10
 #define	IICHID_SAMPLING_HYSTERESIS	1
 
+/*
+ * Taskqueue thread placement. Set dev.iichid.<unit>.taskq_cpu loader tunable
+ * to pin the thread to given CPU and dev.iichid.<unit>.taskq_pri to choose
+ * interrupt thread priority (PI_TTY by default).
+ */
+#define	IICHID_TASKQ_CPU_ANY		-1
+
+/* Dispatch latency histogram has log2 buckets starting at 16us */
+#define	IICHID_LAT_SHIFT		4
+#define	IICHID_LAT_NBUCKETS		12
+
 /* 5.1.1 - HID Descriptor Format */
 struct i2c_hid_desc {
 	uint16_t wHIDDescLength;
@@ -172,6 +187,12 @@ struct iichid_softc {
 	struct taskqueue	*taskqueue;
 	struct task		event_task;
 	struct task		power_task;
+	int			taskq_cpu;
+	int			taskq_pri;
+
+	/* Interrupt to event task dispatch latency, usecs */
+	uint32_t		lat_stamp;	/* 0 - none pending */
+	uint64_t		lat[IICHID_LAT_NBUCKETS];
 
 	bool			open;		/* intr_mtx */
 	bool			suspend;	/* iicbus lock */
@@ -585,8 +606,16 @@ iichid_event_task(void *context, int pending)
 	struct iichid_softc *sc = context;
 	device_t parent = device_get_parent(sc->dev);
 	iichid_size_t maxlen, actual = 0;
+	uint32_t stamp;
 	bool locked = false;
-	int error;
+	int error, bucket;
+
+	stamp = atomic_readandclear_32(&sc->lat_stamp);
+	if (stamp != 0) {
+		bucket = fls((int)(((uint32_t)sbttous(sbinuptime()) - stamp) >>
+		    IICHID_LAT_SHIFT));
+		sc->lat[MIN(bucket, IICHID_LAT_NBUCKETS - 1)]++;
+	}
 
 	if (iicbus_request_bus(parent, sc->dev, IIC_WAIT) != 0)
 		goto rearm;
@@ -677,6 +706,9 @@ iichid_intr(void *context)
 		sc->intr_handler(sc->intr_ctx, sc->intr_buf, actual);
 	mtx_unlock(sc->intr_mtx);
 #else
+	/* Stamp is never 0 to distinguish it from "none pending" value */
+	atomic_cmpset_32(&sc->lat_stamp, 0,
+	    MAX((uint32_t)sbttous(sbinuptime()), 1));
 	taskqueue_enqueue(sc->taskqueue, &sc->event_task);
 #endif
 }
@@ -874,6 +906,55 @@ iichid_sysctl_sampling_rate_handler(SYSCTL_HANDLER_ARGS)
 }
 #endif /* IICHID_SAMPLING */
 
+static int
+iichid_sysctl_latency_handler(SYSCTL_HANDLER_ARGS)
+{
+	struct iichid_softc *sc = arg1;
+	struct sbuf *sb;
+	int error, i;
+
+	sb = sbuf_new_for_sysctl(NULL, NULL, 128, req);
+	for (i = 0; i < IICHID_LAT_NBUCKETS - 1; i++)
+		sbuf_printf(sb, "%s<%uus:%ju", i == 0 ? "" : " ",
+		    1u << (IICHID_LAT_SHIFT + i), (uintmax_t)sc->lat[i]);
+	sbuf_printf(sb, " >=%uus:%ju", 1u << (IICHID_LAT_SHIFT + i - 1),
+	    (uintmax_t)sc->lat[i]);
+	error = sbuf_finish(sb);
+	sbuf_delete(sb);
+
+	return (error);
+}
+
+static void
+iichid_start_taskqueue(struct iichid_softc *sc)
+{
+	cpuset_t mask;
+
+	if (sc->taskq_pri < PRI_MIN_ITHD || sc->taskq_pri > PRI_MAX_ITHD) {
+		device_printf(sc->dev, "taskqueue priority %d is not an "
+		    "interrupt thread priority, using %d\n", sc->taskq_pri,
+		    PI_TTY);
+		sc->taskq_pri = PI_TTY;
+	}
+	if (sc->taskq_cpu != IICHID_TASKQ_CPU_ANY &&
+	    (sc->taskq_cpu < 0 || sc->taskq_cpu > mp_maxid ||
+	     CPU_ABSENT(sc->taskq_cpu))) {
+		device_printf(sc->dev, "CPU %d is not available, taskqueue "
+		    "is not pinned\n", sc->taskq_cpu);
+		sc->taskq_cpu = IICHID_TASKQ_CPU_ANY;
+	}
+
+	if (sc->taskq_cpu == IICHID_TASKQ_CPU_ANY) {
+		taskqueue_start_threads(&sc->taskqueue, 1, sc->taskq_pri,
+		    "%s taskq", device_get_nameunit(sc->dev));
+		return;
+	}
+
+	CPU_SETOF(sc->taskq_cpu, &mask);
+	taskqueue_start_threads_cpuset(&sc->taskqueue, 1, sc->taskq_pri,
+	    &mask, "%s taskq", device_get_nameunit(sc->dev));
+}
+
 static void
 iichid_intr_setup(device_t dev, struct mtx *mtx, hid_intr_t intr,
     void *context, struct hid_rdesc_info *rdesc)
@@ -893,8 +974,7 @@ iichid_intr_setup(device_t dev, struct mtx *mtx, hid_intr_t intr,
 	sc->intr_mtx = mtx;
 	sc->intr_buf = malloc(rdesc->rdsize, M_DEVBUF, M_WAITOK | M_ZERO);
 	sc->intr_bufsize = rdesc->rdsize;
-	taskqueue_start_threads(&sc->taskqueue, 1, PI_TTY,
-	    "%s taskq", device_get_nameunit(sc->dev));
+	iichid_start_taskqueue(sc);
 }
 
 static void
@@ -1204,6 +1284,24 @@ iichid_attach(device_t dev)
 	sc->sampling_hysteresis = IICHID_SAMPLING_HYSTERESIS;
 #endif
 
+	sc->taskq_cpu = IICHID_TASKQ_CPU_ANY;
+	sc->taskq_pri = PI_TTY;
+	SYSCTL_ADD_INT(device_get_sysctl_ctx(sc->dev),
+		SYSCTL_CHILDREN(device_get_sysctl_tree(sc->dev)),
+		OID_AUTO, "taskq_cpu", CTLFLAG_RDTUN,
+		&sc->taskq_cpu, 0,
+		"CPU the taskqueue thread is bound to, -1 - any");
+	SYSCTL_ADD_INT(device_get_sysctl_ctx(sc->dev),
+		SYSCTL_CHILDREN(device_get_sysctl_tree(sc->dev)),
+		OID_AUTO, "taskq_pri", CTLFLAG_RDTUN,
+		&sc->taskq_pri, 0,
+		"Taskqueue thread priority");
+	SYSCTL_ADD_PROC(device_get_sysctl_ctx(sc->dev),
+		SYSCTL_CHILDREN(device_get_sysctl_tree(sc->dev)),
+		OID_AUTO, "dispatch_latency", CTLTYPE_STRING | CTLFLAG_RD,
+		sc, 0, iichid_sysctl_latency_handler, "A",
+		"Interrupt to taskqueue dispatch latency histogram");
+
 	sc->irq_rid = 0;
 	sc->irq_res = bus_alloc_resource_any(sc->dev, SYS_RES_IRQ,
 	    &sc->irq_rid, RF_ACTIVE);
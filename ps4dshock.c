@@ -37,11 +37,14 @@ __FBSDID("$FreeBSD$");
 
 #include <sys/param.h>
 #include <sys/bus.h>
+#include <sys/endian.h>
 #include <sys/kernel.h>
 #include <sys/lock.h>
 #include <sys/module.h>
 #include <sys/sx.h>
 #include <sys/sysctl.h>
+#include <sys/systm.h>
+#include <sys/taskqueue.h>
 
 #include <dev/evdev/input.h>
 #include <dev/evdev/evdev.h>
@@ -598,13 +601,12 @@ static const uint8_t	ps4dshock_rdesc[] = {
 #define	PS4DS_FEATURE_REPORT2_SIZE	37
 #define	PS4DS_OUTPUT_REPORT5_SIZE	32
 #define	PS4DS_OUTPUT_REPORT11_SIZE	78
+/* Minimal interval between consecutive output reports, msecs */
+#define	PS4DS_OUT_INTERVAL_DEF		16
+#define	PS4DS_OUT_INTERVAL_MAX		1000
 
 static hidmap_cb_t	ps4dshock_final_cb;
-static hidmap_cb_t	ps4dsacc_data_cb;
-static hidmap_cb_t	ps4dsacc_tstamp_cb;
 static hidmap_cb_t	ps4dsacc_final_cb;
-static hidmap_cb_t	ps4dsmtp_data_cb;
-static hidmap_cb_t	ps4dsmtp_npackets_cb;
 static hidmap_cb_t	ps4dsmtp_final_cb;
 
 struct ps4ds_out5 {
@@ -642,9 +644,44 @@ enum ps4ds_led_state {
 	PD4DS_LED_CNT,
 };
 
+/*
+ * GamePad block of input report 1 as laid out by ps4dshock_rdesc.
+ * Offset does not include report ID byte.
+ */
+#define	PS4DS_PAD_OFFSET	0
+struct ps4ds_pad {
+	uint8_t		axes[4];	/* X, Y, Rx, Ry */
+	uint8_t		buttons[3];	/* 4 bits hat, 14 buttons, counter */
+	uint8_t		triggers[2];	/* Z, Rz */
+} __attribute__((packed));
+#define	PS4DS_PAD_HAT_MASK	0x0F
+#define	PS4DS_PAD_HAT_NULL	0x08
+#define	PS4DS_PAD_BTN_SHIFT	4
+#define	PS4DS_PAD_BUTTONS(pad)						\
+	(((pad)->buttons[0] | (pad)->buttons[1] << 8 |			\
+	    (pad)->buttons[2] << 16) >> PS4DS_PAD_BTN_SHIFT)
+
+static const uint16_t ps4ds_pad_axes[] = { ABS_X, ABS_Y, ABS_RX, ABS_RY };
+static const uint16_t ps4ds_pad_triggers[] = { ABS_Z, ABS_RZ };
+/* Click button (14) is handled by touchpad driver */
+static const uint16_t ps4ds_pad_buttons[] = {
+	BTN_WEST, BTN_SOUTH, BTN_EAST, BTN_NORTH, BTN_TL, BTN_TR, BTN_TL2,
+	BTN_TR2, BTN_SELECT, BTN_START, BTN_THUMBL, BTN_THUMBR, BTN_MODE,
+};
+
+/*
+ * Motion sensors block of input report 1 as laid out by ps4dshock_rdesc.
+ * Offset does not include report ID byte.
+ */
+#define	PS4DS_IMU_OFFSET	9
+struct ps4ds_imu {
+	uint16_t	tstamp;		/* 5.33us units */
+	uint8_t		battery;
+	int16_t		axes[6];	/* Rx, Ry, Rz, X, Y, Z */
+} __attribute__((packed));
+
 /* Map structure for accelerometer and gyro. */
 struct ps4ds_calib_data {
-	int32_t usage;
 	int32_t code;
 	int32_t res;
 	int32_t range;
@@ -652,19 +689,99 @@ struct ps4ds_calib_data {
 	int16_t bias;
 	int32_t sens_numer;
 	int32_t sens_denom;
+	/* Fixed-point form of sens_numer / sens_denom */
+	int32_t sens_mult;
+	int	sens_shift;
 };
+#define	PS4DS_CALIB_SHIFT_MAX	30
 
-enum {
-	PS4DS_TSTAMP,
-	PS4DS_CID1,
-	PS4DS_TIP1,
-	PS4DS_X1,
-	PS4DS_Y1,
-	PS4DS_CID2,
-	PS4DS_TIP2,
-	PS4DS_X2,
-	PS4DS_Y2,
-	PS4DS_NTPUSAGES,
+/*
+ * Touchpad block of input report 1 as laid out by ps4dshock_rdesc.
+ * Offset does not include report ID byte.
+ */
+#define	PS4DS_TP_OFFSET		32
+struct ps4ds_tp_touch {
+	uint8_t		cid;		/* bit 7 is set when not touching */
+	uint8_t		xy[3];		/* 12 bits X then 12 bits Y */
+} __attribute__((packed));
+#define	PS4DS_TP_NOTOUCH	0x80
+#define	PS4DS_TP_CID_MASK	0x7F
+
+struct ps4ds_tp_packet {
+	uint8_t			tstamp;	/* 682us units */
+	struct ps4ds_tp_touch	touch[2];
+} __attribute__((packed));
+
+struct ps4ds_tp {
+	uint8_t			npackets;	/* low 4 bits */
+	struct ps4ds_tp_packet	packets[];
+} __attribute__((packed));
+
+CTASSERT(sizeof(struct ps4ds_pad) == 9);
+CTASSERT(PS4DS_IMU_OFFSET == PS4DS_PAD_OFFSET + sizeof(struct ps4ds_pad));
+CTASSERT(sizeof(struct ps4ds_imu) == 15);
+CTASSERT(sizeof(struct ps4ds_tp_packet) == 9);
+
+/*
+ * Locations of HID items which fixed offset decoders above rely on. They
+ * are checked against report descriptor at attach, so ps4dshock_rdesc and
+ * the structures can not silently go out of sync.
+ */
+#define	PS4DS_BITPOS(offset, type, field)				\
+	(((offset) + offsetof(type, field)) * 8)
+#define	PS4DS_PAD_POS(field)						\
+	PS4DS_BITPOS(PS4DS_PAD_OFFSET, struct ps4ds_pad, field)
+#define	PS4DS_IMU_POS(field)						\
+	PS4DS_BITPOS(PS4DS_IMU_OFFSET, struct ps4ds_imu, field)
+#define	PS4DS_TP_POS(field)						\
+	PS4DS_BITPOS(PS4DS_TP_OFFSET, struct ps4ds_tp, field)
+/* All blocks belong to input report 1 */
+#define	PS4DS_LAYOUT(page, usage, index, pos, size)			\
+	HIDMAP_LAYOUT(page, usage, index, 1, pos, size)
+
+static const struct hidmap_layout ps4ds_pad_layout[] = {
+	PS4DS_LAYOUT(HUP_GENERIC_DESKTOP, HUG_X, 0, PS4DS_PAD_POS(axes[0]), 8),
+	PS4DS_LAYOUT(HUP_GENERIC_DESKTOP, HUG_Y, 0, PS4DS_PAD_POS(axes[1]), 8),
+	PS4DS_LAYOUT(HUP_GENERIC_DESKTOP, HUG_RX, 0, PS4DS_PAD_POS(axes[2]), 8),
+	PS4DS_LAYOUT(HUP_GENERIC_DESKTOP, HUG_RY, 0, PS4DS_PAD_POS(axes[3]), 8),
+	PS4DS_LAYOUT(HUP_GENERIC_DESKTOP, HUG_HAT_SWITCH, 0,
+	    PS4DS_PAD_POS(buttons[0]), 4),
+	PS4DS_LAYOUT(HUP_BUTTON, 1, 0,
+	    PS4DS_PAD_POS(buttons[0]) + PS4DS_PAD_BTN_SHIFT, 1),
+	PS4DS_LAYOUT(HUP_BUTTON, 13, 0,
+	    PS4DS_PAD_POS(buttons[0]) + PS4DS_PAD_BTN_SHIFT + 12, 1),
+	PS4DS_LAYOUT(HUP_GENERIC_DESKTOP, HUG_Z, 0,
+	    PS4DS_PAD_POS(triggers[0]), 8),
+	PS4DS_LAYOUT(HUP_GENERIC_DESKTOP, HUG_RZ, 0,
+	    PS4DS_PAD_POS(triggers[1]), 8),
+};
+static const struct hidmap_layout ps4ds_imu_layout[] = {
+	PS4DS_LAYOUT(HUP_MICROSOFT, 0x0021, 0, PS4DS_IMU_POS(tstamp), 16),
+	PS4DS_LAYOUT(HUP_GENERIC_DESKTOP, HUG_RX, 0,
+	    PS4DS_IMU_POS(axes[0]), 16),
+	PS4DS_LAYOUT(HUP_GENERIC_DESKTOP, HUG_RZ, 0,
+	    PS4DS_IMU_POS(axes[2]), 16),
+	PS4DS_LAYOUT(HUP_GENERIC_DESKTOP, HUG_X, 0,
+	    PS4DS_IMU_POS(axes[3]), 16),
+	PS4DS_LAYOUT(HUP_GENERIC_DESKTOP, HUG_Z, 0,
+	    PS4DS_IMU_POS(axes[5]), 16),
+};
+static const struct hidmap_layout ps4ds_tp_layout[] = {
+	PS4DS_LAYOUT(HUP_MICROSOFT, 0x0021, 0, PS4DS_TP_POS(npackets), 4),
+	PS4DS_LAYOUT(HUP_DIGITIZERS, HUD_SCAN_TIME, 0,
+	    PS4DS_TP_POS(packets[0].tstamp), 8),
+	PS4DS_LAYOUT(HUP_DIGITIZERS, HUD_CONTACTID, 0,
+	    PS4DS_TP_POS(packets[0].touch[0].cid), 7),
+	PS4DS_LAYOUT(HUP_DIGITIZERS, HUD_TIP_SWITCH, 0,
+	    PS4DS_TP_POS(packets[0].touch[0].cid) + 7, 1),
+	PS4DS_LAYOUT(HUP_GENERIC_DESKTOP, HUG_X, 0,
+	    PS4DS_TP_POS(packets[0].touch[0].xy[0]), 12),
+	PS4DS_LAYOUT(HUP_GENERIC_DESKTOP, HUG_Y, 0,
+	    PS4DS_TP_POS(packets[0].touch[0].xy[0]) + 12, 12),
+	PS4DS_LAYOUT(HUP_DIGITIZERS, HUD_CONTACTID, 1,
+	    PS4DS_TP_POS(packets[0].touch[1].cid), 7),
+	PS4DS_LAYOUT(HUP_DIGITIZERS, HUD_SCAN_TIME, 1,
+	    PS4DS_TP_POS(packets[1].tstamp), 8),
 };
 
 struct ps4dshock_softc {
@@ -672,6 +789,9 @@ struct ps4dshock_softc {
 
 	bool			is_bluetooth;
 
+	/* Last reported GamePad block. Unchanged controls are not pushed */
+	struct ps4ds_pad	pad_last;
+
 	struct sx		lock;
 	enum ps4ds_led_state	led_state;
 	struct ps4ds_led	led_color;
@@ -680,6 +800,18 @@ struct ps4dshock_softc {
 
 	int			rumble_right;
 	int			rumble_left;
+
+	/*
+	 * Output reports are sent from taskqueue. Parameter changes made
+	 * while report is pending are merged into it.
+	 */
+	struct timeout_task	out_task;
+	bool			out_dirty;
+	bool			out_gone;
+	int			out_last;	/* ticks */
+	int			out_interval;	/* msecs */
+	uint64_t		out_reports;
+	uint64_t		out_coalesced;
 };
 
 struct ps4dsacc_softc {
@@ -688,6 +820,7 @@ struct ps4dsacc_softc {
 	uint16_t		hw_tstamp;
 	int32_t			ev_tstamp;
 
+	/* Indexed in the same order as struct ps4ds_imu axes */
 	struct ps4ds_calib_data	calib_data[6];
 };
 
@@ -695,9 +828,6 @@ struct ps4dsmtp_softc {
 	struct hidmap		hm;
 
 	struct hid_location	btn_loc;
-	u_int		npackets;
-	int32_t		*data_ptr;
-	int32_t		data[PS4DS_MAX_TOUCHPAD_PACKETS * PS4DS_NTPUSAGES];
 
 	bool		do_tstamps;
 	uint8_t		hw_tstamp;
@@ -716,54 +846,19 @@ enum {
 #define	PD4DSHOCK_SYSCTL_LAST		PD4DSHOCK_SYSCTL_LED_DELAY_OFF
 };
 
-#define PS4DS_MAP_BTN(number, code)		\
-	{ HIDMAP_KEY(HUP_BUTTON, number, code) }
-#define PS4DS_MAP_ABS(usage, code)		\
-	{ HIDMAP_ABS(HUP_GENERIC_DESKTOP, HUG_##usage, code) }
-#define PS4DS_MAP_FLT(usage, code)		\
-	{ HIDMAP_ABS(HUP_GENERIC_DESKTOP, HUG_##usage, code), .flat = 15 }
 #define PS4DS_MAP_VSW(usage, code)	\
 	{ HIDMAP_SW(HUP_MICROSOFT, usage, code) }
-#define PS4DS_MAP_GCB(usage, callback)	\
-	{ HIDMAP_ANY_CB(HUP_GENERIC_DESKTOP, HUG_##usage, callback) }
 #define PS4DS_MAP_VCB(usage, callback)	\
 	{ HIDMAP_ANY_CB(HUP_MICROSOFT, usage, callback) }
 #define PS4DS_FINALCB(cb)			\
 	{ HIDMAP_FINAL_CB(&cb) }
 
 static const struct hidmap_item ps4dshock_map[] = {
-	PS4DS_MAP_FLT(X,		ABS_X),
-	PS4DS_MAP_FLT(Y,		ABS_Y),
-	PS4DS_MAP_ABS(Z,		ABS_Z),
-	PS4DS_MAP_FLT(RX,		ABS_RX),
-	PS4DS_MAP_FLT(RY,		ABS_RY),
-	PS4DS_MAP_ABS(RZ,		ABS_RZ),
-	PS4DS_MAP_BTN(1,		BTN_WEST),
-	PS4DS_MAP_BTN(2,		BTN_SOUTH),
-	PS4DS_MAP_BTN(3,		BTN_EAST),
-	PS4DS_MAP_BTN(4,		BTN_NORTH),
-	PS4DS_MAP_BTN(5,		BTN_TL),
-	PS4DS_MAP_BTN(6,		BTN_TR),
-	PS4DS_MAP_BTN(7,		BTN_TL2),
-	PS4DS_MAP_BTN(8,		BTN_TR2),
-	PS4DS_MAP_BTN(9,		BTN_SELECT),
-	PS4DS_MAP_BTN(10,		BTN_START),
-	PS4DS_MAP_BTN(11,		BTN_THUMBL),
-	PS4DS_MAP_BTN(12,		BTN_THUMBR),
-	PS4DS_MAP_BTN(13,		BTN_MODE),
-	/* Click button is handled by touchpad driver */
-	/* PS4DS_MAP_BTN(14,	BTN_LEFT), */
-	PS4DS_MAP_GCB(HAT_SWITCH,	hgame_hat_switch_cb),
+	/* Layout is fixed by ps4dshock_rdesc. Decode it all at once. */
 	PS4DS_FINALCB(			ps4dshock_final_cb),
 };
 static const struct hidmap_item ps4dsacc_map[] = {
-	PS4DS_MAP_GCB(X,		ps4dsacc_data_cb),
-	PS4DS_MAP_GCB(Y,		ps4dsacc_data_cb),
-	PS4DS_MAP_GCB(Z,		ps4dsacc_data_cb),
-	PS4DS_MAP_GCB(RX,		ps4dsacc_data_cb),
-	PS4DS_MAP_GCB(RY,		ps4dsacc_data_cb),
-	PS4DS_MAP_GCB(RZ,		ps4dsacc_data_cb),
-	PS4DS_MAP_VCB(0x0021,		ps4dsacc_tstamp_cb),
+	/* Layout is fixed by ps4dshock_rdesc. Decode it all at once. */
 	PS4DS_FINALCB(			ps4dsacc_final_cb),
 };
 static const struct hidmap_item ps4dshead_map[] = {
@@ -771,12 +866,7 @@ static const struct hidmap_item ps4dshead_map[] = {
 	PS4DS_MAP_VSW(0x0021,		SW_HEADPHONE_INSERT),
 };
 static const struct hidmap_item ps4dsmtp_map[] = {
-	{ HIDMAP_ABS_CB(HUP_MICROSOFT, 0x0021, 		ps4dsmtp_npackets_cb)},
-	{ HIDMAP_ABS_CB(HUP_DIGITIZERS, HUD_SCAN_TIME,	ps4dsmtp_data_cb) },
-	{ HIDMAP_ABS_CB(HUP_DIGITIZERS, HUD_CONTACTID,	ps4dsmtp_data_cb) },
-	{ HIDMAP_ABS_CB(HUP_DIGITIZERS, HUD_TIP_SWITCH,	ps4dsmtp_data_cb) },
-	{ HIDMAP_ABS_CB(HUP_GENERIC_DESKTOP, HUG_X,	ps4dsmtp_data_cb) },
-	{ HIDMAP_ABS_CB(HUP_GENERIC_DESKTOP, HUG_Y,	ps4dsmtp_data_cb) },
+	/* Layout is fixed by ps4dshock_rdesc. Decode it all at once. */
 	{ HIDMAP_FINAL_CB(				ps4dsmtp_final_cb) },
 };
 
@@ -800,141 +890,163 @@ static const struct hid_device_id ps4dsmtp_devs[] = {
 static int
 ps4dshock_final_cb(HIDMAP_CB_ARGS)
 {
+	struct ps4dshock_softc *sc = HIDMAP_CB_GET_SOFTC();
 	struct evdev_dev *evdev = HIDMAP_CB_GET_EVDEV();
-
-	if (HIDMAP_CB_GET_STATE() == HIDMAP_CB_IS_ATTACHING)
-		evdev_support_prop(evdev, INPUT_PROP_DIRECT);
-
-	/* Do not execute callback at interrupt handler and detach */
-	return (ENOSYS);
-}
-
-static int
-ps4dsacc_data_cb(HIDMAP_CB_ARGS)
-{
-	struct evdev_dev *evdev = HIDMAP_CB_GET_EVDEV();
-	struct ps4dsacc_softc *sc = HIDMAP_CB_GET_SOFTC();
-	struct ps4ds_calib_data *calib;
+	const struct ps4ds_pad *pad;
+	struct ps4ds_pad *last;
+	uint32_t changed;
 	u_int i;
+	bool do_sync = false;
 
 	switch (HIDMAP_CB_GET_STATE()) {
 	case HIDMAP_CB_IS_ATTACHING:
-		for (i = 0; i < nitems(sc->calib_data); i++) {
-			if (sc->calib_data[i].usage == ctx.hi->usage) {
-				evdev_support_abs(evdev,
-				     sc->calib_data[i].code, 0,
-				    -sc->calib_data[i].range,
-				     sc->calib_data[i].range, 16, 0,
-				     sc->calib_data[i].res);
-				HIDMAP_CB_UDATA = &sc->calib_data[i];
-				break;
-			}
-		}
+		evdev_support_event(evdev, EV_ABS);
+		for (i = 0; i < nitems(ps4ds_pad_axes); i++)
+			evdev_support_abs(evdev, ps4ds_pad_axes[i], 0, 0, 255,
+			    0, 15, 0);
+		for (i = 0; i < nitems(ps4ds_pad_triggers); i++)
+			evdev_support_abs(evdev, ps4ds_pad_triggers[i], 0, 0,
+			    255, 0, 0, 0);
+		evdev_support_event(evdev, EV_KEY);
+		for (i = 0; i < nitems(ps4ds_pad_buttons); i++)
+			evdev_support_key(evdev, ps4ds_pad_buttons[i]);
+		hgame_hat_switch_cb(hm, hi, ctx);
+		evdev_support_prop(evdev, INPUT_PROP_DIRECT);
+		sc->pad_last.buttons[0] = PS4DS_PAD_HAT_NULL;
 		break;
 
 	case HIDMAP_CB_IS_RUNNING:
-		calib = HIDMAP_CB_UDATA;
-		evdev_push_abs(evdev, calib->code,
-		    ((int64_t)ctx.data - calib->bias) * calib->sens_numer /
-		    calib->sens_denom);
+		/* Only packets with ReportID=1 are accepted */
+		if (HIDMAP_CB_GET_RID() != 1 ||
+		    hm->intr_len < PS4DS_PAD_OFFSET + sizeof(*pad))
+			return (ENOTSUP);
+		pad = (const struct ps4ds_pad *)
+		    ((const uint8_t *)hm->intr_buf + PS4DS_PAD_OFFSET);
+		last = &sc->pad_last;
+
+		for (i = 0; i < nitems(ps4ds_pad_axes); i++) {
+			if (pad->axes[i] == last->axes[i])
+				continue;
+			evdev_push_abs(evdev, ps4ds_pad_axes[i], pad->axes[i]);
+			do_sync = true;
+		}
+		for (i = 0; i < nitems(ps4ds_pad_triggers); i++) {
+			if (pad->triggers[i] == last->triggers[i])
+				continue;
+			evdev_push_abs(evdev, ps4ds_pad_triggers[i],
+			    pad->triggers[i]);
+			do_sync = true;
+		}
+		changed = PS4DS_PAD_BUTTONS(pad) ^ PS4DS_PAD_BUTTONS(last);
+		for (i = 0; i < nitems(ps4ds_pad_buttons); i++) {
+			if ((changed & (1 << i)) == 0)
+				continue;
+			evdev_push_key(evdev, ps4ds_pad_buttons[i],
+			    PS4DS_PAD_BUTTONS(pad) & (1 << i));
+			do_sync = true;
+		}
+		if (((pad->buttons[0] ^ last->buttons[0]) &
+		    PS4DS_PAD_HAT_MASK) != 0) {
+			hgame_hat_switch_cb(hm, hi, (union hidmap_cb_ctx){
+			    .data = pad->buttons[0] & PS4DS_PAD_HAT_MASK });
+			do_sync = true;
+		}
+		*last = *pad;
+
+		/* Do not sync evdev if nothing has changed */
+		if (!do_sync)
+			return (ENOMSG);
 		break;
 
 	default:
 		break;
 	}
 
+	/* Do execute callback at interrupt handler and detach */
 	return (0);
 }
 
 static int
-ps4dsacc_tstamp_cb(HIDMAP_CB_ARGS)
+ps4dsacc_final_cb(HIDMAP_CB_ARGS)
 {
 	struct evdev_dev *evdev = HIDMAP_CB_GET_EVDEV();
 	struct ps4dsacc_softc *sc = HIDMAP_CB_GET_SOFTC();
+	const struct ps4ds_imu *imu;
+	struct ps4ds_calib_data *calib;
 	uint16_t tstamp;
+	int32_t val;
+	u_int i;
 
 	switch (HIDMAP_CB_GET_STATE()) {
 	case HIDMAP_CB_IS_ATTACHING:
+		evdev_support_event(evdev, EV_ABS);
+		for (i = 0; i < nitems(sc->calib_data); i++) {
+			calib = &sc->calib_data[i];
+			evdev_support_abs(evdev, calib->code, 0, -calib->range,
+			    calib->range, 16, 0, calib->res);
+		}
 		evdev_support_event(evdev, EV_MSC);
 		evdev_support_msc(evdev, MSC_TIMESTAMP);
+		evdev_support_prop(evdev, INPUT_PROP_ACCELEROMETER);
 		break;
 
 	case HIDMAP_CB_IS_RUNNING:
+		/* Only packets with ReportID=1 are accepted */
+		if (HIDMAP_CB_GET_RID() != 1 ||
+		    hm->intr_len < PS4DS_IMU_OFFSET + sizeof(*imu))
+			return (ENOTSUP);
+		imu = (const struct ps4ds_imu *)
+		    ((const uint8_t *)hm->intr_buf + PS4DS_IMU_OFFSET);
+
 		/* Convert timestamp (in 5.33us unit) to timestamp_us */
-		tstamp = (uint16_t)ctx.data;
+		tstamp = le16toh(imu->tstamp);
 		sc->ev_tstamp += (uint16_t)(tstamp - sc->hw_tstamp) * 16 / 3;
 		sc->hw_tstamp = tstamp;
 		evdev_push_msc(evdev, MSC_TIMESTAMP, sc->ev_tstamp);
+
+		for (i = 0; i < nitems(sc->calib_data); i++) {
+			calib = &sc->calib_data[i];
+			val = (int16_t)le16toh(imu->axes[i]);
+			evdev_push_abs(evdev, calib->code,
+			    ((int64_t)val - calib->bias) * calib->sens_mult >>
+			    calib->sens_shift);
+		}
 		break;
 
 	default:
 		break;
 	}
 
+	/* Do execute callback at interrupt handler and detach */
 	return (0);
 }
 
-static int
-ps4dsacc_final_cb(HIDMAP_CB_ARGS)
-{
-	struct evdev_dev *evdev = HIDMAP_CB_GET_EVDEV();
-
-	if (HIDMAP_CB_GET_STATE() == HIDMAP_CB_IS_ATTACHING) {
-		evdev_support_event(evdev, EV_ABS);
-		evdev_support_prop(evdev, INPUT_PROP_ACCELEROMETER);
-	}
-        /* Do not execute callback at interrupt handler and detach */
-        return (ENOSYS);
-}
-
-static int
-ps4dsmtp_npackets_cb(HIDMAP_CB_ARGS)
-{
-	struct ps4dsmtp_softc *sc = HIDMAP_CB_GET_SOFTC();
-
-	if (HIDMAP_CB_GET_STATE() == HIDMAP_CB_IS_RUNNING) {
-		sc->npackets = MIN(PS4DS_MAX_TOUCHPAD_PACKETS,(u_int)ctx.data);
-		/* Reset pointer here as it is first usage in touchpad TLC */
-		sc->data_ptr = sc->data;
-	}
-
-	return (0);
-}
-
-static int
-ps4dsmtp_data_cb(HIDMAP_CB_ARGS)
+static void
+ps4dsmtp_push_touch(struct evdev_dev *evdev, int slot,
+    const struct ps4ds_tp_touch *touch)
 {
-	struct ps4dsmtp_softc *sc = HIDMAP_CB_GET_SOFTC();
-
-	if (HIDMAP_CB_GET_STATE() == HIDMAP_CB_IS_RUNNING) {
-		*sc->data_ptr = ctx.data;
-		++sc->data_ptr;
-	}
 
-	return (0);
+	evdev_push_abs(evdev, ABS_MT_SLOT, slot);
+	if ((touch->cid & PS4DS_TP_NOTOUCH) == 0) {
+		evdev_push_abs(evdev, ABS_MT_TRACKING_ID,
+		    touch->cid & PS4DS_TP_CID_MASK);
+		evdev_push_abs(evdev, ABS_MT_POSITION_X,
+		    touch->xy[0] | (touch->xy[1] & 0x0F) << 8);
+		evdev_push_abs(evdev, ABS_MT_POSITION_Y,
+		    touch->xy[1] >> 4 | touch->xy[2] << 4);
+	} else
+		evdev_push_abs(evdev, ABS_MT_TRACKING_ID, -1);
 }
 
 static void
 ps4dsmtp_push_packet(struct ps4dsmtp_softc *sc, struct evdev_dev *evdev,
-    int32_t *data)
+    const struct ps4ds_tp_packet *packet)
 {
 	uint8_t hw_tstamp, delta;
 	bool touch;
 
-	evdev_push_abs(evdev, ABS_MT_SLOT, 0);
-	if (data[PS4DS_TIP1] == 0) {
-		evdev_push_abs(evdev, ABS_MT_TRACKING_ID, data[PS4DS_CID1]);
-		evdev_push_abs(evdev, ABS_MT_POSITION_X, data[PS4DS_X1]);
-		evdev_push_abs(evdev, ABS_MT_POSITION_Y, data[PS4DS_Y1]);
-	} else
-		evdev_push_abs(evdev, ABS_MT_TRACKING_ID, -1);
-	evdev_push_abs(evdev, ABS_MT_SLOT, 1);
-	if (data[PS4DS_TIP2] == 0) {
-		evdev_push_abs(evdev, ABS_MT_TRACKING_ID, data[PS4DS_CID2]);
-		evdev_push_abs(evdev, ABS_MT_POSITION_X, data[PS4DS_X2]);
-		evdev_push_abs(evdev, ABS_MT_POSITION_Y, data[PS4DS_Y2]);
-	} else
-		evdev_push_abs(evdev, ABS_MT_TRACKING_ID, -1);
+	ps4dsmtp_push_touch(evdev, 0, &packet->touch[0]);
+	ps4dsmtp_push_touch(evdev, 1, &packet->touch[1]);
 
 	if (sc->do_tstamps) {
 		/*
@@ -943,10 +1055,11 @@ ps4dsmtp_push_packet(struct ps4dsmtp_softc *sc, struct evdev_dev *evdev,
 		 * timestamps to be on per 1usec basis and reset
 		 * counter at the start of each touch.
 		 */
-		hw_tstamp = (uint8_t)data[PS4DS_TSTAMP];
+		hw_tstamp = packet->tstamp;
 		delta = hw_tstamp - sc->hw_tstamp;
 		sc->hw_tstamp = hw_tstamp;
-		touch = data[PS4DS_TIP1] == 0 || data[PS4DS_TIP2] == 0;
+		touch = (packet->touch[0].cid & PS4DS_TP_NOTOUCH) == 0 ||
+		    (packet->touch[1].cid & PS4DS_TP_NOTOUCH) == 0;
 		/* Hardware timestamp counter ticks in 682 usec interval. */
 		if ((touch || sc->touch) && delta != 0) {
 			if (sc->touch)
@@ -964,7 +1077,8 @@ ps4dsmtp_final_cb(HIDMAP_CB_ARGS)
 {
 	struct ps4dsmtp_softc *sc = HIDMAP_CB_GET_SOFTC();
 	struct evdev_dev *evdev = HIDMAP_CB_GET_EVDEV();
-	int32_t *data;
+	const struct ps4ds_tp *tp;
+	u_int i, npackets;
 
 	switch (HIDMAP_CB_GET_STATE()) {
 	case HIDMAP_CB_IS_ATTACHING:
@@ -999,14 +1113,19 @@ ps4dsmtp_final_cb(HIDMAP_CB_ARGS)
 
 	case HIDMAP_CB_IS_RUNNING:
 		/* Only packets with ReportID=1 are accepted */
-		if (HIDMAP_CB_GET_RID() != 1)
+		if (HIDMAP_CB_GET_RID() != 1 ||
+		    hm->intr_len < PS4DS_TP_OFFSET + sizeof(*tp))
 			return (ENOTSUP);
+		tp = (const struct ps4ds_tp *)
+		    ((const uint8_t *)hm->intr_buf + PS4DS_TP_OFFSET);
+		npackets = MIN(tp->npackets & 0x0F, MIN(
+		    PS4DS_MAX_TOUCHPAD_PACKETS,
+		    (hm->intr_len - PS4DS_TP_OFFSET - sizeof(*tp)) /
+		    sizeof(tp->packets[0])));
 		evdev_push_key(evdev, BTN_LEFT,
 		    HIDMAP_CB_GET_UDATA(&sc->btn_loc));
-		for (data = sc->data;
-		     data < sc->data + PS4DS_NTPUSAGES * sc->npackets;
-		     data += PS4DS_NTPUSAGES) {
-			ps4dsmtp_push_packet(sc, evdev, data);
+		for (i = 0; i < npackets; i++) {
+			ps4dsmtp_push_packet(sc, evdev, &tp->packets[i]);
 			evdev_sync(evdev);
 		}
 		break;
@@ -1070,6 +1189,47 @@ ps4dshock_write(struct ps4dshock_softc *sc)
 	return (hid_write(sc->hm.dev, buf, osize));
 }
 
+static void
+ps4dshock_out_task(void *context, int pending)
+{
+	struct ps4dshock_softc *sc = context;
+
+	sx_xlock(&sc->lock);
+	if (sc->out_dirty && !sc->out_gone) {
+		sc->out_dirty = false;
+		sc->out_last = ticks;
+		sc->out_reports++;
+		ps4dshock_write(sc);
+	}
+	sx_unlock(&sc->lock);
+}
+
+/*
+ * Request output report with current state. The report is sent not earlier
+ * than out_interval msecs after previous one and carries all the changes
+ * made in the meantime.
+ */
+static void
+ps4dshock_schedule_write(struct ps4dshock_softc *sc)
+{
+	int delay, interval;
+
+	sx_assert(&sc->lock, SA_XLOCKED);
+
+	if (sc->out_gone)
+		return;
+	if (sc->out_dirty) {
+		sc->out_coalesced++;
+		return;
+	}
+	sc->out_dirty = true;
+
+	interval = MIN(MAX(sc->out_interval, 0), PS4DS_OUT_INTERVAL_MAX);
+	delay = sc->out_last + howmany(interval * hz, 1000) - ticks;
+	taskqueue_enqueue_timeout(taskqueue_thread, &sc->out_task,
+	    MAX(delay, 0));
+}
+
 /* Synaptics Touchpad */
 static int
 ps4dshock_sysctl(SYSCTL_HANDLER_ARGS)
@@ -1119,7 +1279,7 @@ ps4dshock_sysctl(SYSCTL_HANDLER_ARGS)
 	/* Update. */
 	if (error == 0) {
 		*(int *)((char *)sc + oidp->oid_arg2) = arg;
-		ps4dshock_write(sc);
+		ps4dshock_schedule_write(sc);
 	}
 unlock:
 	sx_unlock(&sc->lock);
@@ -1188,13 +1348,20 @@ ps4dshock_attach(device_t dev)
 	struct sysctl_ctx_list *ctx = device_get_sysctl_ctx(dev);
 	struct sysctl_oid *tree = device_get_sysctl_tree(dev);
 
+	if (HIDMAP_CHECK_LAYOUT(dev, ps4ds_pad_layout) != 0)
+		return (ENXIO);
+
 	sc->led_state = PS4DS_LED_ON;
 	sc->led_color = ps4ds_leds[device_get_unit(dev) % nitems(ps4ds_leds)];
 	sc->led_delay_on = 500;	/* 1 Hz */
 	sc->led_delay_off = 500;
+	sc->out_interval = PS4DS_OUT_INTERVAL_DEF;
 	ps4dshock_write(sc);
+	sc->out_last = ticks;
 
 	sx_init(&sc->lock, "ps4dshock");
+	TIMEOUT_TASK_INIT(taskqueue_thread, &sc->out_task, 0,
+	    ps4dshock_out_task, sc);
 
 	SYSCTL_ADD_PROC(ctx, SYSCTL_CHILDREN(tree), OID_AUTO,
 	    "led_state", CTLTYPE_INT | CTLFLAG_RW | CTLFLAG_ANYBODY, sc,
@@ -1226,15 +1393,63 @@ ps4dshock_attach(device_t dev)
 	    PD4DSHOCK_SYSCTL_LED_DELAY_OFF, ps4dshock_sysctl, "I",
 	    "LED blink. Off delay, msecs.");
 
+	SYSCTL_ADD_INT(ctx, SYSCTL_CHILDREN(tree), OID_AUTO,
+	    "out_interval", CTLFLAG_RW, &sc->out_interval, 0,
+	    "Minimal interval between output reports, msecs.");
+	SYSCTL_ADD_U64(ctx, SYSCTL_CHILDREN(tree), OID_AUTO,
+	    "out_reports", CTLFLAG_RD, &sc->out_reports, 0,
+	    "Number of output reports sent.");
+	SYSCTL_ADD_U64(ctx, SYSCTL_CHILDREN(tree), OID_AUTO,
+	    "out_coalesced", CTLFLAG_RD, &sc->out_coalesced, 0,
+	    "Number of updates merged into pending output report.");
+
 	return (hidmap_attach(&sc->hm));
 }
 
+/*
+ * Replace per-report 64-bit division with multiplication and shift.
+ * Pick the largest shift which keeps multiplier within 32 bits to retain
+ * as much precision as possible.
+ */
+static void
+ps4dsacc_calib_prepare(struct ps4ds_calib_data *calib)
+{
+	int64_t mult;
+	int shift;
+
+	/* Calibration data is unavailable. Report raw values. */
+	if (calib->sens_denom == 0) {
+		DPRINTF("zero sensitivity denominator for axis %d\n",
+		    calib->code);
+		calib->bias = 0;
+		calib->sens_mult = 1;
+		calib->sens_shift = 0;
+		return;
+	}
+
+	for (shift = PS4DS_CALIB_SHIFT_MAX; ; shift--) {
+		mult = (int64_t)calib->sens_numer * ((int64_t)1 << shift) /
+		    calib->sens_denom;
+		if ((mult <= INT32_MAX && mult >= INT32_MIN) || shift == 0)
+			break;
+	}
+	calib->sens_mult = mult;
+	calib->sens_shift = shift;
+
+	DPRINTFN(5, "axis %d: bias=%d mult=%d shift=%d\n", calib->code,
+	    calib->bias, calib->sens_mult, calib->sens_shift);
+}
+
 static int
 ps4dsacc_attach(device_t dev)
 {
 	struct ps4dsacc_softc *sc = device_get_softc(dev);
 	uint8_t buf[PS4DS_FEATURE_REPORT2_SIZE];
 	int error, speed_2x, range_2g;
+	u_int i;
+
+	if (HIDMAP_CHECK_LAYOUT(dev, ps4ds_imu_layout) != 0)
+		return (ENXIO);
 
 	/* Read accelerometers and gyroscopes calibration data */
 	error = hid_get_report(dev, buf, sizeof(buf), NULL,
@@ -1252,7 +1467,6 @@ ps4dsacc_attach(device_t dev)
 	 */
 #define HGETW(w) ((int16_t)((w)[0] | (((uint16_t)((w)[1])) << 8)))
 	speed_2x = HGETW(&buf[19]) + HGETW(&buf[21]);
-	sc->calib_data[0].usage = HID_USAGE2(HUP_GENERIC_DESKTOP, HUG_RX);
 	sc->calib_data[0].code = ABS_RX;
 	sc->calib_data[0].range = PS4DS_GYRO_RES_PER_DEG_S * 2048;
 	sc->calib_data[0].res = PS4DS_GYRO_RES_PER_DEG_S;
@@ -1262,7 +1476,6 @@ ps4dsacc_attach(device_t dev)
 	/* BT case */
 	/* sc->calib_data[0].sens_denom = HGETW(&buf[7]) - HGETW(&buf[13]); */
 
-	sc->calib_data[1].usage = HID_USAGE2(HUP_GENERIC_DESKTOP, HUG_RY);
 	sc->calib_data[1].code = ABS_RY;
 	sc->calib_data[1].range = PS4DS_GYRO_RES_PER_DEG_S * 2048;
 	sc->calib_data[1].res = PS4DS_GYRO_RES_PER_DEG_S;
@@ -1272,7 +1485,6 @@ ps4dsacc_attach(device_t dev)
 	/* BT case */
 	/* sc->calib_data[1].sens_denom = HGETW(&buf[9]) - HGETW(&buf[15]); */
 
-	sc->calib_data[2].usage = HID_USAGE2(HUP_GENERIC_DESKTOP, HUG_RZ);
 	sc->calib_data[2].code = ABS_RZ;
 	sc->calib_data[2].range = PS4DS_GYRO_RES_PER_DEG_S * 2048;
 	sc->calib_data[2].res = PS4DS_GYRO_RES_PER_DEG_S;
@@ -1287,7 +1499,6 @@ ps4dsacc_attach(device_t dev)
 	 * Data values will be normalized to 1 / PS4DS_ACC_RES_PER_G G.
 	 */
 	range_2g = HGETW(&buf[23]) - HGETW(&buf[25]);
-	sc->calib_data[3].usage = HID_USAGE2(HUP_GENERIC_DESKTOP, HUG_X);
 	sc->calib_data[3].code = ABS_X;
 	sc->calib_data[3].range = PS4DS_ACC_RES_PER_G * 4;
 	sc->calib_data[3].res = PS4DS_ACC_RES_PER_G;
@@ -1296,7 +1507,6 @@ ps4dsacc_attach(device_t dev)
 	sc->calib_data[3].sens_denom = range_2g;
 
 	range_2g = HGETW(&buf[27]) - HGETW(&buf[29]);
-	sc->calib_data[4].usage =  HID_USAGE2(HUP_GENERIC_DESKTOP, HUG_Y);
 	sc->calib_data[4].code = ABS_Y;
 	sc->calib_data[4].range = PS4DS_ACC_RES_PER_G * 4;
 	sc->calib_data[4].res = PS4DS_ACC_RES_PER_G;
@@ -1305,7 +1515,6 @@ ps4dsacc_attach(device_t dev)
 	sc->calib_data[4].sens_denom = range_2g;
 
 	range_2g = HGETW(&buf[31]) - HGETW(&buf[33]);
-	sc->calib_data[5].usage = HID_USAGE2(HUP_GENERIC_DESKTOP, HUG_Z);
 	sc->calib_data[5].code = ABS_Z;
 	sc->calib_data[5].range = PS4DS_ACC_RES_PER_G * 4;
 	sc->calib_data[5].res = PS4DS_ACC_RES_PER_G;
@@ -1313,6 +1522,9 @@ ps4dsacc_attach(device_t dev)
 	sc->calib_data[5].sens_numer = 2 * PS4DS_ACC_RES_PER_G;
 	sc->calib_data[5].sens_denom = range_2g;
 
+	for (i = 0; i < nitems(sc->calib_data); i++)
+		ps4dsacc_calib_prepare(&sc->calib_data[i]);
+
 	return (hidmap_attach(&sc->hm));
 }
 
@@ -1327,6 +1539,9 @@ ps4dsmtp_attach(device_t dev)
 {
 	struct ps4dsmtp_softc *sc = device_get_softc(dev);
 
+	if (HIDMAP_CHECK_LAYOUT(dev, ps4ds_tp_layout) != 0)
+		return (ENXIO);
+
 	return (hidmap_attach(&sc->hm));
 }
 
@@ -1336,6 +1551,10 @@ ps4dshock_detach(device_t dev)
 	struct ps4dshock_softc *sc = device_get_softc(dev);
 
 	hidmap_detach(&sc->hm);
+	sx_xlock(&sc->lock);
+	sc->out_gone = true;
+	sx_unlock(&sc->lock);
+	taskqueue_drain_timeout(taskqueue_thread, &sc->out_task);
 	sc->led_state = PS4DS_LED_OFF;
 	ps4dshock_write(sc);
 	sx_destroy(&sc->lock);
@@ -57,6 +57,8 @@ __FBSDID("$FreeBSD$");
 #include <sys/priv.h>
 #include <sys/conf.h>
 #include <sys/fcntl.h>
+#include <sys/sbuf.h>
+#include <sys/time.h>
 
 #include <dev/evdev/input.h>
 
@@ -117,6 +119,28 @@ struct usbhid_xfer_ctx {
 	bool influx;
 };
 
+/* Control request latency histogram has log2 buckets starting at 128us */
+#define	USBHID_LAT_SHIFT	7
+#define	USBHID_LAT_NBUCKETS	11
+
+/* Transfer statistics. Protected by sc_intr_mtx */
+struct usbhid_stats {
+	uint64_t	intr_in_xfers;	/* Interrupt IN completions */
+	uint64_t	intr_in_bytes;
+	uint64_t	intr_in_short;	/* Completions shorter than report */
+	uint64_t	stalls;		/* Stall clears issued */
+	uint64_t	err_stalled;
+	uint64_t	err_timeout;
+	uint64_t	err_ioerror;
+	uint64_t	err_other;
+	uint64_t	sync_xfers;
+	uint64_t	sync_waits;	/* Sync xfers waited for sc_xfer_ctx */
+	uint64_t	ctrl_lat[USBHID_LAT_NBUCKETS];
+	uint64_t	intr_run_xfers;	/* IN completions since intr_start */
+	sbintime_t	intr_run_start;
+	uint32_t	intr_nominal_us; /* Nominal IN endpoint poll period */
+};
+
 struct usbhid_softc {
 	hid_intr_t *sc_intr_handler;
 	void *sc_intr_ctx;
@@ -129,6 +153,13 @@ struct usbhid_softc {
 	struct usb_xfer *sc_xfer[USBHID_N_TRANSFER];
 	struct usbhid_xfer_ctx sc_xfer_ctx[USBHID_N_TRANSFER];
 
+	struct usbhid_stats sc_stats;
+
+	/* Expected input report sizes indexed by report ID. 0 if unknown */
+	hid_size_t *sc_isize;
+	u_int sc_nisize;
+	bool sc_has_rid;
+
 	struct usb_device *sc_udev;
 	uint8_t	sc_iface_no;
 	uint8_t	sc_iface_index;
@@ -146,6 +177,45 @@ static usb_callback_t usbhid_ctrl_callback;
 static usbhid_callback_t usbhid_intr_handler_cb;
 static usbhid_callback_t usbhid_sync_wakeup_cb;
 
+static hid_set_idle_t usbhid_set_idle;
+
+static void
+usbhid_count_error(struct usb_xfer *xfer, usb_error_t error)
+{
+	struct usbhid_softc *sc = usbd_xfer_get_priv(xfer);
+
+	switch (error) {
+	case USB_ERR_CANCELLED:
+		break;
+	case USB_ERR_STALLED:
+		sc->sc_stats.err_stalled++;
+		break;
+	case USB_ERR_TIMEOUT:
+		sc->sc_stats.err_timeout++;
+		break;
+	case USB_ERR_IOERROR:
+		sc->sc_stats.err_ioerror++;
+		break;
+	default:
+		sc->sc_stats.err_other++;
+		break;
+	}
+}
+
+/*
+ * Stall clear is requested after any transfer error but only errors on
+ * stalled endpoint are counted as stalls.
+ */
+static void
+usbhid_clear_stall(struct usb_xfer *xfer, usb_error_t error)
+{
+	struct usbhid_softc *sc = usbd_xfer_get_priv(xfer);
+
+	if (error == USB_ERR_STALLED)
+		sc->sc_stats.stalls++;
+	usbd_xfer_set_stall(xfer);
+}
+
 static void
 usbhid_intr_out_callback(struct usb_xfer *xfer, usb_error_t error)
 {
@@ -174,9 +244,10 @@ tr_setup:
 		goto tr_exit;
 
 	default:			/* Error */
+		usbhid_count_error(xfer, error);
 		if (error != USB_ERR_CANCELLED) {
 			/* try to clear stall first */
-			usbd_xfer_set_stall(xfer);
+			usbhid_clear_stall(xfer, error);
 			goto tr_setup;
 		}
 		xfer_ctx->error = EIO;
@@ -186,10 +257,29 @@ tr_exit:
 	}
 }
 
+/*
+ * Returns expected size of received input report. Devices with several
+ * report IDs send reports of different sizes, so the report ID is taken
+ * in to account when it is known.
+ */
+static hid_size_t
+usbhid_report_isize(struct usbhid_softc *sc, struct usbhid_xfer_ctx *xfer_ctx,
+    int actlen)
+{
+	uint8_t id;
+
+	if (sc->sc_isize == NULL || actlen == 0)
+		return (xfer_ctx->req.intr.maxlen);
+
+	id = sc->sc_has_rid ? xfer_ctx->buf[0] : 0;
+	return (sc->sc_isize[id]);
+}
+
 static void
 usbhid_intr_in_callback(struct usb_xfer *xfer, usb_error_t error)
 {
 	struct usbhid_xfer_ctx *xfer_ctx = usbd_xfer_softc(xfer);
+	struct usbhid_softc *sc = usbd_xfer_get_priv(xfer);
 	struct usb_page_cache *pc;
 	int actlen;
 
@@ -198,8 +288,13 @@ usbhid_intr_in_callback(struct usb_xfer *xfer, usb_error_t error)
 		DPRINTF("transferred!\n");
 
 		usbd_xfer_status(xfer, &actlen, NULL, NULL, NULL);
+		sc->sc_stats.intr_in_xfers++;
+		sc->sc_stats.intr_run_xfers++;
+		sc->sc_stats.intr_in_bytes += actlen;
 		pc = usbd_xfer_get_frame(xfer, 0);
 		usbd_copy_out(pc, 0, xfer_ctx->buf, actlen);
+		if (actlen < usbhid_report_isize(sc, xfer_ctx, actlen))
+			sc->sc_stats.intr_in_short++;
 		xfer_ctx->req.intr.actlen = actlen;
 		if (xfer_ctx->cb(xfer_ctx) != 0)
 			return;
@@ -211,9 +306,10 @@ re_submit:
 		return;
 
 	default:			/* Error */
+		usbhid_count_error(xfer, error);
 		if (error != USB_ERR_CANCELLED) {
 			/* try to clear stall first */
-			usbd_xfer_set_stall(xfer);
+			usbhid_clear_stall(xfer, error);
 			goto re_submit;
 		}
 		return;
@@ -256,6 +352,7 @@ usbhid_ctrl_callback(struct usb_xfer *xfer, usb_error_t error)
 	default:			/* Error */
 		/* bomb out */
 		DPRINTFN(1, "error=%s\n", usbd_errstr(error));
+		usbhid_count_error(xfer, error);
 		xfer_ctx->error = EIO;
 tr_exit:
 		(void)xfer_ctx->cb(xfer_ctx);
@@ -310,6 +407,89 @@ static const struct usb_config usbhid_config[USBHID_N_TRANSFER] = {
 	},
 };
 
+/* Returns nominal interrupt IN endpoint polling period in microseconds */
+static uint32_t
+usbhid_intr_interval(struct usbhid_softc *sc)
+{
+	struct usb_endpoint *ep;
+	uint8_t ival;
+
+	ep = usbd_get_endpoint(sc->sc_udev, sc->sc_iface_index,
+	    usbhid_config + USBHID_INTR_IN_DT);
+	if (ep == NULL || ep->edesc == NULL)
+		return (0);
+
+	ival = ep->edesc->bInterval;
+	switch (usbd_get_speed(sc->sc_udev)) {
+	case USB_SPEED_LOW:
+	case USB_SPEED_FULL:
+		/* bInterval is measured in frames */
+		return (MAX(ival, 1) * 1000);
+	default:
+		/* bInterval is an exponent of the number of microframes */
+		ival = MIN(MAX(ival, 1), 16);
+		return (125 << (ival - 1));
+	}
+}
+
+static void
+usbhid_idle_setup(device_t dev, const struct hid_rdesc_info *rdesc)
+{
+	struct usbhid_softc* sc = device_get_softc(dev);
+	struct hid_data *hd;
+	struct hid_item hi;
+	uint8_t ids[howmany(256, NBBY)] = { 0 };
+	bool do_idle;
+	u_int id;
+	int error;
+
+	if (rdesc->data == NULL || rdesc->len == 0)
+		return;
+
+	/* Collect input report IDs */
+	hd = hid_start_parse(rdesc->data, rdesc->len, 1 << hid_input);
+	while (hid_get_item(hd, &hi)) {
+		if (hi.kind != hid_input || (hi.flags & HIO_CONST) != 0)
+			continue;
+		setbit(ids, hi.report_ID);
+	}
+	hid_end_parse(hd);
+
+	sc->sc_has_rid = rdesc->iid != 0;
+	sc->sc_nisize = sc->sc_has_rid ? 256 : 1;
+	sc->sc_isize = malloc(sc->sc_nisize * sizeof(hid_size_t),
+	    M_USBDEV, M_ZERO | M_WAITOK);
+
+	/*
+	 * SET_IDLE(0) for report ID 0 has already been issued at attach. It
+	 * applies to all reports but some devices expect per-ID requests.
+	 */
+	do_idle = sc->sc_has_rid && sc->sc_xfer[USBHID_CTRL_DT] != NULL &&
+	    !hid_test_quirk(&sc->sc_hw, HQ_NO_SET_IDLE);
+
+	for (id = 0; id < sc->sc_nisize; id++) {
+		if (isclr(ids, id))
+			continue;
+		if (do_idle) {
+			error = usbhid_set_idle(dev, 0, id);
+			if (error != 0)
+				DPRINTF("set idle failed for ID %u, error=%d "
+				    "(ignored)\n", id, error);
+		}
+		sc->sc_isize[id] = hid_report_size_1(rdesc->data, rdesc->len,
+		    hid_input, id);
+	}
+}
+
+static void
+usbhid_idle_unsetup(device_t dev)
+{
+	struct usbhid_softc* sc = device_get_softc(dev);
+
+	free(sc->sc_isize, M_USBDEV);
+	sc->sc_isize = NULL;
+}
+
 static void
 usbhid_intr_setup(device_t dev, struct mtx *mtx, hid_intr_t intr,
     void *context, struct hid_rdesc_info *rdesc)
@@ -346,11 +526,14 @@ usbhid_intr_setup(device_t dev, struct mtx *mtx, hid_intr_t intr,
 		    (void *)(sc->sc_xfer_ctx + n), sc->sc_intr_mtx);
 		if (error)
 			break;
+		usbd_xfer_set_priv(sc->sc_xfer[n], sc);
 	}
 
 	if (error)
 		DPRINTF("error=%s\n", usbd_errstr(error));
 
+	sc->sc_stats.intr_nominal_us = usbhid_intr_interval(sc);
+
 	rdesc->rdsize = usbd_xfer_max_len(sc->sc_xfer[USBHID_INTR_IN_DT]);
 	rdesc->grsize = usbd_xfer_max_len(sc->sc_xfer[USBHID_CTRL_DT]);
 	rdesc->srsize = rdesc->grsize;
@@ -358,6 +541,8 @@ usbhid_intr_setup(device_t dev, struct mtx *mtx, hid_intr_t intr,
 	    usbd_xfer_max_len(sc->sc_xfer[USBHID_INTR_OUT_DT]);
 
 	sc->sc_intr_buf = malloc(rdesc->rdsize, M_USBDEV, M_ZERO | M_WAITOK);
+
+	usbhid_idle_setup(dev, rdesc);
 }
 
 static void
@@ -367,6 +552,7 @@ usbhid_intr_unsetup(device_t dev)
 
 	usbd_transfer_unsetup(sc->sc_xfer, USBHID_N_TRANSFER);
 	free(sc->sc_intr_buf, M_USBDEV);
+	usbhid_idle_unsetup(dev);
 }
 
 static int
@@ -383,6 +569,8 @@ usbhid_intr_start(device_t dev)
 		.cb_ctx = sc,
 		.buf = sc->sc_intr_buf,
 	};
+	sc->sc_stats.intr_run_xfers = 0;
+	sc->sc_stats.intr_run_start = sbinuptime();
 	usbd_transfer_start(sc->sc_xfer[USBHID_INTR_IN_DT]);
 
 	return (0);
@@ -412,12 +600,22 @@ usbhid_intr_poll(device_t dev)
 /*
  * HID interface
  */
+static void
+usbhid_count_latency(struct usbhid_softc *sc, sbintime_t sbt)
+{
+	int bucket;
+
+	bucket = fls((int)(sbttous(sbt) >> USBHID_LAT_SHIFT));
+	sc->sc_stats.ctrl_lat[MIN(bucket, USBHID_LAT_NBUCKETS - 1)]++;
+}
+
 static int
 usbhid_sync_xfer(struct usbhid_softc* sc, int xfer_idx,
     union usbhid_device_request *req, void *buf)
 {
 	int error, timeout;
 	struct usbhid_xfer_ctx *xfer_ctx, save;
+	sbintime_t start;
 
 	xfer_ctx = sc->sc_xfer_ctx + xfer_idx;
 
@@ -425,6 +623,9 @@ usbhid_sync_xfer(struct usbhid_softc* sc, int xfer_idx,
 		save = *xfer_ctx;
 	} else {
 		mtx_lock(sc->sc_intr_mtx);
+		sc->sc_stats.sync_xfers++;
+		if (xfer_ctx->influx)
+			sc->sc_stats.sync_waits++;
 		++xfer_ctx->waiters;
 		while (xfer_ctx->influx)
 			mtx_sleep(&xfer_ctx->waiters, sc->sc_intr_mtx, 0,
@@ -439,6 +640,7 @@ usbhid_sync_xfer(struct usbhid_softc* sc, int xfer_idx,
 	xfer_ctx->cb = &usbhid_sync_wakeup_cb;
 	xfer_ctx->cb_ctx = xfer_ctx;
 	timeout = USB_DEFAULT_TIMEOUT;
+	start = sbinuptime();
 	usbd_transfer_start(sc->sc_xfer[xfer_idx]);
 
 	if (USB_IN_POLLING_MODE_FUNC())
@@ -459,6 +661,11 @@ usbhid_sync_xfer(struct usbhid_softc* sc, int xfer_idx,
 	error = xfer_ctx->error;
 	if (error == 0)
 		*req = xfer_ctx->req;
+	else if (error == ETIMEDOUT)
+		sc->sc_stats.err_timeout++;
+	/* Failed and timed out requests would skew the histogram */
+	if (xfer_idx == USBHID_CTRL_DT && error == 0)
+		usbhid_count_latency(sc, sbinuptime() - start);
 
 	if (USB_IN_POLLING_MODE_FUNC()) {
 		*xfer_ctx = save;
@@ -642,6 +849,100 @@ usbhid_fill_device_info(struct usb_attach_arg *uaa, struct hid_device_info *hw)
 		hid_add_dynamic_quirk(hw, HQ_NOWRITE);
 }
 
+static int
+usbhid_stats_latency_sysctl(SYSCTL_HANDLER_ARGS)
+{
+	struct usbhid_softc *sc = arg1;
+	struct sbuf *sb;
+	int error, i;
+
+	sb = sbuf_new_for_sysctl(NULL, NULL, 128, req);
+	for (i = 0; i < USBHID_LAT_NBUCKETS - 1; i++)
+		sbuf_printf(sb, "%s<%uus:%ju", i == 0 ? "" : " ",
+		    1u << (USBHID_LAT_SHIFT + i),
+		    (uintmax_t)sc->sc_stats.ctrl_lat[i]);
+	sbuf_printf(sb, " >=%uus:%ju", 1u << (USBHID_LAT_SHIFT + i - 1),
+	    (uintmax_t)sc->sc_stats.ctrl_lat[i]);
+	error = sbuf_finish(sb);
+	sbuf_delete(sb);
+
+	return (error);
+}
+
+static int
+usbhid_stats_rate_sysctl(SYSCTL_HANDLER_ARGS)
+{
+	struct usbhid_softc *sc = arg1;
+	int64_t elapsed;
+	u_int rate = 0;
+
+	elapsed = sbttoms(sbinuptime() - sc->sc_stats.intr_run_start);
+	if (sc->sc_stats.intr_run_start != 0 && elapsed > 0)
+		rate = sc->sc_stats.intr_run_xfers * 1000 / elapsed;
+
+	return (sysctl_handle_int(oidp, &rate, 0, req));
+}
+
+static int
+usbhid_stats_nominal_rate_sysctl(SYSCTL_HANDLER_ARGS)
+{
+	struct usbhid_softc *sc = arg1;
+	u_int rate;
+
+	rate = sc->sc_stats.intr_nominal_us == 0 ? 0 :
+	    1000000 / sc->sc_stats.intr_nominal_us;
+
+	return (sysctl_handle_int(oidp, &rate, 0, req));
+}
+
+static void
+usbhid_stats_sysctl_init(device_t dev)
+{
+	struct usbhid_softc *sc = device_get_softc(dev);
+	struct sysctl_ctx_list *ctx = device_get_sysctl_ctx(dev);
+	struct sysctl_oid *tree;
+	struct sysctl_oid_list *list;
+
+	tree = SYSCTL_ADD_NODE(ctx,
+	    SYSCTL_CHILDREN(device_get_sysctl_tree(dev)), OID_AUTO, "stats",
+	    CTLFLAG_RD, NULL, "Transfer statistics");
+	list = SYSCTL_CHILDREN(tree);
+
+#define	USBHID_STATS_U64(name, field, descr)				\
+	SYSCTL_ADD_U64(ctx, list, OID_AUTO, (name), CTLFLAG_RD,		\
+	    &sc->sc_stats.field, 0, (descr))
+	USBHID_STATS_U64("intr_in_xfers", intr_in_xfers,
+	    "Interrupt IN transfers completed");
+	USBHID_STATS_U64("intr_in_bytes", intr_in_bytes,
+	    "Bytes received over interrupt IN endpoint");
+	USBHID_STATS_U64("intr_in_short", intr_in_short,
+	    "Interrupt IN transfers shorter than their input report");
+	USBHID_STATS_U64("stalls", stalls, "Endpoint stalls cleared");
+	USBHID_STATS_U64("errors_stalled", err_stalled,
+	    "Transfers failed with stalled endpoint");
+	USBHID_STATS_U64("errors_timeout", err_timeout,
+	    "Transfers failed with timeout");
+	USBHID_STATS_U64("errors_ioerror", err_ioerror,
+	    "Transfers failed with I/O error");
+	USBHID_STATS_U64("errors_other", err_other,
+	    "Transfers failed with other errors");
+	USBHID_STATS_U64("sync_xfers", sync_xfers,
+	    "Synchronous requests issued");
+	USBHID_STATS_U64("sync_waits", sync_waits,
+	    "Synchronous requests waited for transfer context");
+#undef	USBHID_STATS_U64
+
+	SYSCTL_ADD_PROC(ctx, list, OID_AUTO, "ctrl_latency",
+	    CTLTYPE_STRING | CTLFLAG_RD, sc, 0, usbhid_stats_latency_sysctl,
+	    "A", "Successful control request latency histogram");
+	SYSCTL_ADD_PROC(ctx, list, OID_AUTO, "intr_rate",
+	    CTLTYPE_UINT | CTLFLAG_RD, sc, 0, usbhid_stats_rate_sysctl,
+	    "IU", "Achieved interrupt IN transfer rate (Hz)");
+	SYSCTL_ADD_PROC(ctx, list, OID_AUTO, "intr_rate_nominal",
+	    CTLTYPE_UINT | CTLFLAG_RD, sc, 0, usbhid_stats_nominal_rate_sysctl,
+	    "IU", "Nominal interrupt IN endpoint polling rate (Hz)");
+}
+
 static const STRUCT_USB_HOST_ID usbhid_devs[] = {
 	/* the Xbox 360 gamepad doesn't use the HID class */
 	{USB_IFACE_CLASS(UICLASS_VENDOR),
@@ -719,12 +1020,15 @@ usbhid_attach(device_t dev)
 	sc->sc_iface_index = uaa->info.bIfaceIndex;
 
 	usbhid_fill_device_info(uaa, &sc->sc_hw);
-
-	error = usbd_req_set_idle(uaa->device, NULL,
-	    uaa->info.bIfaceIndex, 0, 0);
-	if (error) {
-		DPRINTF("set idle failed, error=%s (ignored)\n",
-		    usbd_errstr(error));
+	usbhid_stats_sysctl_init(dev);
+
+	if (!hid_test_quirk(&sc->sc_hw, HQ_NO_SET_IDLE)) {
+		error = usbd_req_set_idle(uaa->device, NULL,
+		    uaa->info.bIfaceIndex, 0, 0);
+		if (error) {
+			DPRINTF("set idle failed, error=%s (ignored)\n",
+			    usbd_errstr(error));
+		}
 	}
 
 	child = device_add_child(dev, "hidbus", -1);
@@ -54,43 +54,81 @@ __FBSDID("$FreeBSD$");
 
 static const uint8_t	xb360gp_rdesc[] = {UHID_XB360GP_REPORT_DESCR()};
 
-#define XB360GP_MAP_BUT(number, code)	\
-	{ HIDMAP_KEY(HUP_BUTTON, number, code) }
-#define XB360GP_MAP_ABS(usage, code)	\
-	{ HIDMAP_ABS(HUP_GENERIC_DESKTOP, HUG_##usage, code) }
+/*
+ * D-pad and buttons block of the input report as laid out by the usbhid
+ * XBox 360 descriptor: D-pad up, down, left, right, buttons 8, 7, 9, 10,
+ * 5, 6, 11, padding bit and buttons 1-4.
+ */
+#define	XB360GP_BTN_OFFSET	2
+#define	XB360GP_BTN_GET(buf)						\
+	((buf)[XB360GP_BTN_OFFSET] | (buf)[XB360GP_BTN_OFFSET + 1] << 8)
+#define	XB360GP_DPAD_UP		0x0001
+#define	XB360GP_DPAD_DOWN	0x0002
+#define	XB360GP_DPAD_LEFT	0x0004
+#define	XB360GP_DPAD_RIGHT	0x0008
+
+static const uint16_t xb360gp_buttons[16] = {
+	[4] = BTN_START, [5] = BTN_SELECT, [6] = BTN_THUMBL, [7] = BTN_THUMBR,
+	[8] = BTN_TL, [9] = BTN_TR, [10] = BTN_MODE,
+	[12] = BTN_SOUTH, [13] = BTN_EAST, [14] = BTN_WEST, [15] = BTN_NORTH,
+};
+
+/* Checked against report descriptor at attach. Report has no ID */
+#define	XB360GP_BTN_POS(bit)	(XB360GP_BTN_OFFSET * 8 + (bit))
+#define	XB360GP_LAYOUT(page, usage, bit)				\
+	HIDMAP_LAYOUT(page, usage, 0, 0, XB360GP_BTN_POS(bit), 1)
+static const struct hidmap_layout xb360gp_layout[] = {
+	XB360GP_LAYOUT(HUP_GENERIC_DESKTOP, HUG_D_PAD_UP, 0),
+	XB360GP_LAYOUT(HUP_GENERIC_DESKTOP, HUG_D_PAD_DOWN, 1),
+	XB360GP_LAYOUT(HUP_GENERIC_DESKTOP, HUG_D_PAD_LEFT, 2),
+	XB360GP_LAYOUT(HUP_GENERIC_DESKTOP, HUG_D_PAD_RIGHT, 3),
+	XB360GP_LAYOUT(HUP_BUTTON, 8, 4),
+	XB360GP_LAYOUT(HUP_BUTTON, 7, 5),
+	XB360GP_LAYOUT(HUP_BUTTON, 9, 6),
+	XB360GP_LAYOUT(HUP_BUTTON, 10, 7),
+	XB360GP_LAYOUT(HUP_BUTTON, 5, 8),
+	XB360GP_LAYOUT(HUP_BUTTON, 6, 9),
+	XB360GP_LAYOUT(HUP_BUTTON, 11, 10),
+	XB360GP_LAYOUT(HUP_BUTTON, 1, 12),
+	XB360GP_LAYOUT(HUP_BUTTON, 2, 13),
+	XB360GP_LAYOUT(HUP_BUTTON, 3, 14),
+	XB360GP_LAYOUT(HUP_BUTTON, 4, 15),
+};
+
+static hidmap_cb_t	xb360gp_final_cb;
+
+struct xb360gp_softc {
+	struct hidmap		hm;
+
+	/* Last reported D-pad and buttons. Unchanged ones are not pushed */
+	uint16_t		buttons;
+};
+
+#define XB360GP_MAP_TRG(usage, code)	\
+	{ HIDMAP_ABS(HUP_GENERIC_DESKTOP, HUG_##usage, code),	\
+	    .rest_at_min = true }
 #define XB360GP_MAP_ABS_FLT(usage, code)	\
 	{ HIDMAP_ABS(HUP_GENERIC_DESKTOP, HUG_##usage, code),	\
 	    .fuzz = 16, .flat = 128 }
 #define XB360GP_MAP_ABS_INV(usage, code)	\
 	{ HIDMAP_ABS(HUP_GENERIC_DESKTOP, HUG_##usage, code),	\
 	    .fuzz = 16, .flat = 128, .invert_value = true }
-#define XB360GP_MAP_CRG(usage_from, usage_to, callback)	\
-	{ HIDMAP_ANY_CB_RANGE(HUP_GENERIC_DESKTOP,	\
-	    HUG_##usage_from, HUG_##usage_to, callback) }
 #define XB360GP_FINALCB(cb)		\
 	{ HIDMAP_FINAL_CB(&cb) }
 
-/* Customized to match usbhid's XBox 360 descriptor */
+/*
+ * Customized to match usbhid's XBox 360 descriptor. D-pad and buttons are
+ * decoded at fixed offsets by final callback. Axes are left to hidmap as
+ * they carry per-item deadzone and hysteresis state.
+ */
 static const struct hidmap_item xb360gp_map[] = {
-	XB360GP_MAP_BUT(1,		BTN_SOUTH),
-	XB360GP_MAP_BUT(2,		BTN_EAST),
-	XB360GP_MAP_BUT(3,		BTN_WEST),
-	XB360GP_MAP_BUT(4,		BTN_NORTH),
-	XB360GP_MAP_BUT(5,		BTN_TL),
-	XB360GP_MAP_BUT(6,		BTN_TR),
-	XB360GP_MAP_BUT(7,		BTN_SELECT),
-	XB360GP_MAP_BUT(8,		BTN_START),
-	XB360GP_MAP_BUT(9,		BTN_THUMBL),
-	XB360GP_MAP_BUT(10,		BTN_THUMBR),
-	XB360GP_MAP_BUT(11,		BTN_MODE),
-	XB360GP_MAP_CRG(D_PAD_UP, D_PAD_LEFT, hgame_dpad_cb),
 	XB360GP_MAP_ABS_FLT(X,		ABS_X),
 	XB360GP_MAP_ABS_INV(Y,		ABS_Y),
-	XB360GP_MAP_ABS(Z,		ABS_Z),
+	XB360GP_MAP_TRG(Z,		ABS_Z),
 	XB360GP_MAP_ABS_FLT(RX,		ABS_RX),
 	XB360GP_MAP_ABS_INV(RY,		ABS_RY),
-	XB360GP_MAP_ABS(RZ,		ABS_RZ),
-	XB360GP_FINALCB(		hgame_final_cb),
+	XB360GP_MAP_TRG(RZ,		ABS_RZ),
+	XB360GP_FINALCB(		xb360gp_final_cb),
 };
 
 static const STRUCT_USB_HOST_ID xb360gp_devs[] = {
@@ -100,6 +138,63 @@ static const STRUCT_USB_HOST_ID xb360gp_devs[] = {
 	 USB_IFACE_PROTOCOL(UIPROTO_XBOX360_GAMEPAD),},
 };
 
+static int
+xb360gp_final_cb(HIDMAP_CB_ARGS)
+{
+	struct xb360gp_softc *sc = HIDMAP_CB_GET_SOFTC();
+	struct evdev_dev *evdev = HIDMAP_CB_GET_EVDEV();
+	const uint8_t *buf;
+	uint16_t buttons, changed;
+	u_int i;
+
+	switch (HIDMAP_CB_GET_STATE()) {
+	case HIDMAP_CB_IS_ATTACHING:
+		evdev_support_event(evdev, EV_KEY);
+		for (i = 0; i < nitems(xb360gp_buttons); i++)
+			if (xb360gp_buttons[i] != 0)
+				evdev_support_key(evdev, xb360gp_buttons[i]);
+		evdev_support_event(evdev, EV_ABS);
+		evdev_support_abs(evdev, ABS_HAT0X, 0, -1, 1, 0, 0, 0);
+		evdev_support_abs(evdev, ABS_HAT0Y, 0, -1, 1, 0, 0, 0);
+		evdev_support_prop(evdev, INPUT_PROP_DIRECT);
+		break;
+
+	case HIDMAP_CB_IS_RUNNING:
+		if (hm->intr_len < XB360GP_BTN_OFFSET + 2)
+			return (ENOTSUP);
+		buf = hm->intr_buf;
+		buttons = XB360GP_BTN_GET(buf);
+		changed = buttons ^ sc->buttons;
+		sc->buttons = buttons;
+		if (changed == 0)
+			return (ENOMSG);
+
+		for (i = 0; i < nitems(xb360gp_buttons); i++) {
+			if ((changed & (1 << i)) == 0 ||
+			    xb360gp_buttons[i] == 0)
+				continue;
+			evdev_push_key(evdev, xb360gp_buttons[i],
+			    buttons & (1 << i));
+		}
+		/* Opposite directions pressed at once are reported as none */
+		if ((changed & (XB360GP_DPAD_LEFT | XB360GP_DPAD_RIGHT)) != 0)
+			evdev_push_abs(evdev, ABS_HAT0X,
+			    ((buttons & XB360GP_DPAD_RIGHT) != 0) -
+			    ((buttons & XB360GP_DPAD_LEFT) != 0));
+		if ((changed & (XB360GP_DPAD_UP | XB360GP_DPAD_DOWN)) != 0)
+			evdev_push_abs(evdev, ABS_HAT0Y,
+			    ((buttons & XB360GP_DPAD_DOWN) != 0) -
+			    ((buttons & XB360GP_DPAD_UP) != 0));
+		break;
+
+	default:
+		break;
+	}
+
+	/* Do execute callback at interrupt handler and detach */
+	return (0);
+}
+
 static void
 xb360gp_identify(driver_t *driver, device_t parent)
 {
@@ -114,7 +209,7 @@ xb360gp_identify(driver_t *driver, device_t parent)
 static int
 xb360gp_probe(device_t dev)
 {
-	struct hgame_softc *sc = device_get_softc(dev);
+	struct xb360gp_softc *sc = device_get_softc(dev);
 	const struct hid_device_info *hw = hid_get_device_info(dev);
 	int error;
 
@@ -135,9 +230,12 @@ xb360gp_probe(device_t dev)
 static int
 xb360gp_attach(device_t dev)
 {
-	struct hgame_softc *sc = device_get_softc(dev);
+	struct xb360gp_softc *sc = device_get_softc(dev);
 	int error;
 
+	if (HIDMAP_CHECK_LAYOUT(dev, xb360gp_layout) != 0)
+		return (ENXIO);
+
 	/*
 	 * Turn off the four LEDs on the gamepad which
 	 * are blinking by default:
@@ -149,13 +247,18 @@ xb360gp_attach(device_t dev)
 		device_printf(dev, "set output report failed, error=%d "
 		    "(ignored)\n", error);
 
-	return (hidmap_attach(&sc->hm));
+	sc->hm.abs_filter = true;
+	error = hidmap_attach(&sc->hm);
+	if (error == 0)
+		hgame_filter_sysctl_init(&sc->hm);
+
+	return (error);
 }
 
 static int
 xb360gp_detach(device_t dev)
 {
-	struct hgame_softc *sc = device_get_softc(dev);
+	struct xb360gp_softc *sc = device_get_softc(dev);
 
 	return (hidmap_detach(&sc->hm));
 }
@@ -170,7 +273,7 @@ static device_method_t xb360gp_methods[] = {
 };
 
 DEFINE_CLASS_0(xb360gp, xb360gp_driver, xb360gp_methods,
-    sizeof(struct hgame_softc));
+    sizeof(struct xb360gp_softc));
 DRIVER_MODULE(xb360gp, hidbus, xb360gp_driver, xb360gp_devclass, NULL, 0);
 MODULE_DEPEND(xb360gp, hid, 1, 1, 1);
 MODULE_DEPEND(xb360gp, hidmap, 1, 1, 1);